@@ -76,7 +76,7 @@ namespace PhyloTree.Formats
 
                 byte headerByte = reader.ReadByte();
 
-                if ((headerByte & 0b11111100) != 0)
+                if ((headerByte & 0b11111000) != 0)
                 {
                     inputStream.Position = position;
                     return false;
@@ -95,6 +95,20 @@ namespace PhyloTree.Formats
             }
         }
 
+        /// <summary>
+        /// Reads the address of the global dictionary block from the trailer of a file whose <c>DeferredGlobals</c> flag is set.
+        /// </summary>
+        /// <param name="reader">A <see cref="BinaryReader"/> reading the file.</param>
+        /// <param name="labelAddress">The address of the trailer.</param>
+        /// <returns>The address of the global dictionary block (the <c>long</c> following the tree addresses in the trailer).</returns>
+        private static long ReadDictionaryAddress(BinaryReader reader, long labelAddress)
+        {
+            reader.BaseStream.Seek(labelAddress, SeekOrigin.Begin);
+            int numOfTrees = reader.ReadInt();
+            reader.BaseStream.Seek(8L * numOfTrees, SeekOrigin.Current);
+            return reader.ReadInt64();
+        }
+
         /// <summary>
         /// Reads the metadata from a file containing trees in binary format.
         /// </summary>
@@ -128,13 +142,14 @@ namespace PhyloTree.Formats
 
                 byte headerByte = reader.ReadByte();
 
-                if ((headerByte & 0b11111100) != 0)
+                if ((headerByte & 0b11111000) != 0)
                 {
                     throw new FormatException("Invalid file header!");
                 }
 
                 bool globalNames = (headerByte & 0b1) != 0;
                 bool globalAttributes = (headerByte & 0b10) != 0;
+                bool deferredGlobals = (headerByte & 0b100) != 0;
 
                 tbr.GlobalNames = globalNames;
 
@@ -147,11 +162,18 @@ namespace PhyloTree.Formats
                     validTrailer = false;
                 }
 
+                long dictionaryAddress = 5;
+
                 if (validTrailer)
                 {
                     inputStream.Seek(-12, SeekOrigin.End);
                     long labelAddress = reader.ReadInt64();
 
+                    if (deferredGlobals)
+                    {
+                        dictionaryAddress = ReadDictionaryAddress(reader, labelAddress);
+                    }
+
                     IEnumerable<long> getEnumerable()
                     {
                         inputStream.Seek(labelAddress, SeekOrigin.Begin);
@@ -165,8 +187,12 @@ namespace PhyloTree.Formats
 
                     tbr.TreeAddresses = getEnumerable();
                 }
+                else if (deferredGlobals)
+                {
+                    throw new FormatException("The global names and attributes of this file are stored in the trailer, which is missing or invalid!");
+                }
 
-                inputStream.Seek(5, SeekOrigin.Begin);
+                inputStream.Seek(dictionaryAddress, SeekOrigin.Begin);
 
                 string[] allNames = null;
 
@@ -264,13 +290,14 @@ namespace PhyloTree.Formats
 
                 byte headerByte = reader.ReadByte();
 
-                if ((headerByte & 0b11111100) != 0)
+                if ((headerByte & 0b11111000) != 0)
                 {
                     throw new FormatException("Invalid file header!");
                 }
 
                 bool globalNames = (headerByte & 0b1) != 0;
                 bool globalAttributes = (headerByte & 0b10) != 0;
+                bool deferredGlobals = (headerByte & 0b100) != 0;
 
 
                 inputStream.Seek(-4, SeekOrigin.End);
@@ -284,6 +311,8 @@ namespace PhyloTree.Formats
 
                 List<long> treeAddresses;
 
+                long dictionaryAddress = 5;
+
                 if (validTrailer)
                 {
                     inputStream.Seek(-12, SeekOrigin.End);
@@ -297,13 +326,22 @@ namespace PhyloTree.Formats
                     {
                         treeAddresses.Add(reader.ReadInt64());
                     }
+
+                    if (deferredGlobals)
+                    {
+                        dictionaryAddress = reader.ReadInt64();
+                    }
+                }
+                else if (deferredGlobals)
+                {
+                    throw new FormatException("The global names and attributes of this file are stored in the trailer, which is missing or invalid!");
                 }
                 else
                 {
                     treeAddresses = new List<long>();
                 }
 
-                inputStream.Seek(5, SeekOrigin.Begin);
+                inputStream.Seek(dictionaryAddress, SeekOrigin.Begin);
 
                 string[] allNames = null;
 
@@ -6,32 +6,181 @@
 using namespace Rcpp;
 
 // Rcpp_read_binary_tree
-SEXP Rcpp_read_binary_tree(std::string fileName, long offset, bool globalNames, std::vector<std::string> names, std::vector<std::string> attributeNames, std::vector<bool> attributesAreNumeric);
-RcppExport SEXP _TreeNode_Rcpp_read_binary_tree(SEXP fileNameSEXP, SEXP offsetSEXP, SEXP globalNamesSEXP, SEXP namesSEXP, SEXP attributeNamesSEXP, SEXP attributesAreNumericSEXP) {
+SEXP Rcpp_read_binary_tree(SEXP source, double offset, bool globalNames, std::vector<std::string> names, std::vector<std::string> attributeNames, std::vector<bool> attributesAreNumeric, SEXP selectedAttributes, bool topologyOnly);
+RcppExport SEXP _TreeNode_Rcpp_read_binary_tree(SEXP sourceSEXP, SEXP offsetSEXP, SEXP globalNamesSEXP, SEXP namesSEXP, SEXP attributeNamesSEXP, SEXP attributesAreNumericSEXP, SEXP selectedAttributesSEXP, SEXP topologyOnlySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
-    Rcpp::traits::input_parameter< long >::type offset(offsetSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    Rcpp::traits::input_parameter< double >::type offset(offsetSEXP);
     Rcpp::traits::input_parameter< bool >::type globalNames(globalNamesSEXP);
     Rcpp::traits::input_parameter< std::vector<std::string> >::type names(namesSEXP);
     Rcpp::traits::input_parameter< std::vector<std::string> >::type attributeNames(attributeNamesSEXP);
     Rcpp::traits::input_parameter< std::vector<bool> >::type attributesAreNumeric(attributesAreNumericSEXP);
-    rcpp_result_gen = Rcpp::wrap(Rcpp_read_binary_tree(fileName, offset, globalNames, names, attributeNames, attributesAreNumeric));
+    Rcpp::traits::input_parameter< SEXP >::type selectedAttributes(selectedAttributesSEXP);
+    Rcpp::traits::input_parameter< bool >::type topologyOnly(topologyOnlySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_read_binary_tree(source, offset, globalNames, names, attributeNames, attributesAreNumeric, selectedAttributes, topologyOnly));
     return rcpp_result_gen;
 END_RCPP
 }
 // Rcpp_read_binary_trees
-SEXP Rcpp_read_binary_trees(std::string fileName);
-RcppExport SEXP _TreeNode_Rcpp_read_binary_trees(SEXP fileNameSEXP) {
+SEXP Rcpp_read_binary_trees(SEXP source, int threads, SEXP selectedAttributes, bool topologyOnly, SEXP indices, int from, int to, int by);
+RcppExport SEXP _TreeNode_Rcpp_read_binary_trees(SEXP sourceSEXP, SEXP threadsSEXP, SEXP selectedAttributesSEXP, SEXP topologyOnlySEXP, SEXP indicesSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP bySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type selectedAttributes(selectedAttributesSEXP);
+    Rcpp::traits::input_parameter< bool >::type topologyOnly(topologyOnlySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type indices(indicesSEXP);
+    Rcpp::traits::input_parameter< int >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type to(toSEXP);
+    Rcpp::traits::input_parameter< int >::type by(bySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_read_binary_trees(source, threads, selectedAttributes, topologyOnly, indices, from, to, by));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_read_binary_tree_metadata
+SEXP Rcpp_read_binary_tree_metadata(SEXP source, std::string invalidTrailer);
+RcppExport SEXP _TreeNode_Rcpp_read_binary_tree_metadata(SEXP sourceSEXP, SEXP invalidTrailerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    Rcpp::traits::input_parameter< std::string >::type invalidTrailer(invalidTrailerSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_read_binary_tree_metadata(source, invalidTrailer));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_repair_binary_trees
+SEXP Rcpp_repair_binary_trees(std::string fileName);
+RcppExport SEXP _TreeNode_Rcpp_repair_binary_trees(SEXP fileNameSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
-    rcpp_result_gen = Rcpp::wrap(Rcpp_read_binary_trees(fileName));
+    rcpp_result_gen = Rcpp::wrap(Rcpp_repair_binary_trees(fileName));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_append_binary_trees
+int Rcpp_append_binary_trees(Rcpp::List trees, std::string fileName);
+RcppExport SEXP _TreeNode_Rcpp_append_binary_trees(SEXP treesSEXP, SEXP fileNameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type trees(treesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_append_binary_trees(trees, fileName));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_merge_binary_trees
+int Rcpp_merge_binary_trees(std::vector<std::string> inputFiles, std::string outputFile, std::vector<Rbyte> additionalData);
+RcppExport SEXP _TreeNode_Rcpp_merge_binary_trees(SEXP inputFilesSEXP, SEXP outputFileSEXP, SEXP additionalDataSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type inputFiles(inputFilesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type outputFile(outputFileSEXP);
+    Rcpp::traits::input_parameter< std::vector<Rbyte> >::type additionalData(additionalDataSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_merge_binary_trees(inputFiles, outputFile, additionalData));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_subset_binary_trees
+int Rcpp_subset_binary_trees(std::string inputFile, std::string outputFile, SEXP indices, int from, int to, int by);
+RcppExport SEXP _TreeNode_Rcpp_subset_binary_trees(SEXP inputFileSEXP, SEXP outputFileSEXP, SEXP indicesSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP bySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type inputFile(inputFileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type outputFile(outputFileSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type indices(indicesSEXP);
+    Rcpp::traits::input_parameter< int >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type to(toSEXP);
+    Rcpp::traits::input_parameter< int >::type by(bySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_subset_binary_trees(inputFile, outputFile, indices, from, to, by));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_open_binary_tree_reader
+SEXP Rcpp_open_binary_tree_reader(std::string fileName);
+RcppExport SEXP _TreeNode_Rcpp_open_binary_tree_reader(SEXP fileNameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_open_binary_tree_reader(fileName));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_binary_tree_reader_length
+int Rcpp_binary_tree_reader_length(SEXP handle);
+RcppExport SEXP _TreeNode_Rcpp_binary_tree_reader_length(SEXP handleSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_binary_tree_reader_length(handle));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_get_tree
+SEXP Rcpp_get_tree(SEXP handle, int index, SEXP selectedAttributes, bool topologyOnly);
+RcppExport SEXP _TreeNode_Rcpp_get_tree(SEXP handleSEXP, SEXP indexSEXP, SEXP selectedAttributesSEXP, SEXP topologyOnlySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< int >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type selectedAttributes(selectedAttributesSEXP);
+    Rcpp::traits::input_parameter< bool >::type topologyOnly(topologyOnlySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_get_tree(handle, index, selectedAttributes, topologyOnly));
     return rcpp_result_gen;
 END_RCPP
 }
+// Rcpp_get_trees
+SEXP Rcpp_get_trees(SEXP handle, std::vector<int> indices, int threads, SEXP selectedAttributes, bool topologyOnly);
+RcppExport SEXP _TreeNode_Rcpp_get_trees(SEXP handleSEXP, SEXP indicesSEXP, SEXP threadsSEXP, SEXP selectedAttributesSEXP, SEXP topologyOnlySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type indices(indicesSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type selectedAttributes(selectedAttributesSEXP);
+    Rcpp::traits::input_parameter< bool >::type topologyOnly(topologyOnlySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_get_trees(handle, indices, threads, selectedAttributes, topologyOnly));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_binary_tree_reader_next_chunk
+SEXP Rcpp_binary_tree_reader_next_chunk(SEXP handle, int chunkSize, int threads, SEXP selectedAttributes, bool topologyOnly);
+RcppExport SEXP _TreeNode_Rcpp_binary_tree_reader_next_chunk(SEXP handleSEXP, SEXP chunkSizeSEXP, SEXP threadsSEXP, SEXP selectedAttributesSEXP, SEXP topologyOnlySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< int >::type chunkSize(chunkSizeSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type selectedAttributes(selectedAttributesSEXP);
+    Rcpp::traits::input_parameter< bool >::type topologyOnly(topologyOnlySEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_binary_tree_reader_next_chunk(handle, chunkSize, threads, selectedAttributes, topologyOnly));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_close_binary_tree_reader
+void Rcpp_close_binary_tree_reader(SEXP handle);
+RcppExport SEXP _TreeNode_Rcpp_close_binary_tree_reader(SEXP handleSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp_close_binary_tree_reader(handle);
+    return R_NilValue;
+END_RCPP
+}
 // Rcpp_read_nwka_string
 SEXP Rcpp_read_nwka_string(std::string source, bool debug);
 RcppExport SEXP _TreeNode_Rcpp_read_nwka_string(SEXP sourceSEXP, SEXP debugSEXP) {
@@ -69,14 +218,15 @@ BEGIN_RCPP
 END_RCPP
 }
 // Rcpp_write_binary_trees
-void Rcpp_write_binary_trees(Rcpp::List trees, std::string fileName, std::vector<Rbyte> additionalData);
-RcppExport SEXP _TreeNode_Rcpp_write_binary_trees(SEXP treesSEXP, SEXP fileNameSEXP, SEXP additionalDataSEXP) {
+void Rcpp_write_binary_trees(Rcpp::List trees, std::string fileName, std::vector<Rbyte> additionalData, int threads);
+RcppExport SEXP _TreeNode_Rcpp_write_binary_trees(SEXP treesSEXP, SEXP fileNameSEXP, SEXP additionalDataSEXP, SEXP threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::List >::type trees(treesSEXP);
     Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
     Rcpp::traits::input_parameter< std::vector<Rbyte> >::type additionalData(additionalDataSEXP);
-    Rcpp_write_binary_trees(trees, fileName, additionalData);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp_write_binary_trees(trees, fileName, additionalData, threads);
     return R_NilValue;
 END_RCPP
 }
@@ -116,6 +266,43 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// Rcpp_open_binary_tree_writer
+SEXP Rcpp_open_binary_tree_writer(std::string fileName, bool globalDictionaries, int checkpointTrees, double checkpointSeconds);
+RcppExport SEXP _TreeNode_Rcpp_open_binary_tree_writer(SEXP fileNameSEXP, SEXP globalDictionariesSEXP, SEXP checkpointTreesSEXP, SEXP checkpointSecondsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fileName(fileNameSEXP);
+    Rcpp::traits::input_parameter< bool >::type globalDictionaries(globalDictionariesSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpointTrees(checkpointTreesSEXP);
+    Rcpp::traits::input_parameter< double >::type checkpointSeconds(checkpointSecondsSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_open_binary_tree_writer(fileName, globalDictionaries, checkpointTrees, checkpointSeconds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_binary_tree_writer_write
+int Rcpp_binary_tree_writer_write(SEXP handle, Rcpp::List trees);
+RcppExport SEXP _TreeNode_Rcpp_binary_tree_writer_write(SEXP handleSEXP, SEXP treesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type trees(treesSEXP);
+    rcpp_result_gen = Rcpp::wrap(Rcpp_binary_tree_writer_write(handle, trees));
+    return rcpp_result_gen;
+END_RCPP
+}
+// Rcpp_close_binary_tree_writer
+void Rcpp_close_binary_tree_writer(SEXP handle, std::vector<Rbyte> additionalData);
+RcppExport SEXP _TreeNode_Rcpp_close_binary_tree_writer(SEXP handleSEXP, SEXP additionalDataSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< std::vector<Rbyte> >::type additionalData(additionalDataSEXP);
+    Rcpp_close_binary_tree_writer(handle, additionalData);
+    return R_NilValue;
+END_RCPP
+}
 // Rcpp_multiPhylo_to_string
 std::string Rcpp_multiPhylo_to_string(Rcpp::List trees, bool nwka, bool singleQuoted);
 RcppExport SEXP _TreeNode_Rcpp_multiPhylo_to_string(SEXP treesSEXP, SEXP nwkaSEXP, SEXP singleQuotedSEXP) {
@@ -158,15 +345,29 @@ END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_TreeNode_Rcpp_read_binary_tree", (DL_FUNC) &_TreeNode_Rcpp_read_binary_tree, 6},
-    {"_TreeNode_Rcpp_read_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_read_binary_trees, 1},
+    {"_TreeNode_Rcpp_read_binary_tree", (DL_FUNC) &_TreeNode_Rcpp_read_binary_tree, 8},
+    {"_TreeNode_Rcpp_read_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_read_binary_trees, 8},
+    {"_TreeNode_Rcpp_read_binary_tree_metadata", (DL_FUNC) &_TreeNode_Rcpp_read_binary_tree_metadata, 2},
+    {"_TreeNode_Rcpp_repair_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_repair_binary_trees, 1},
+    {"_TreeNode_Rcpp_append_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_append_binary_trees, 2},
+    {"_TreeNode_Rcpp_merge_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_merge_binary_trees, 3},
+    {"_TreeNode_Rcpp_subset_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_subset_binary_trees, 6},
+    {"_TreeNode_Rcpp_open_binary_tree_reader", (DL_FUNC) &_TreeNode_Rcpp_open_binary_tree_reader, 1},
+    {"_TreeNode_Rcpp_binary_tree_reader_length", (DL_FUNC) &_TreeNode_Rcpp_binary_tree_reader_length, 1},
+    {"_TreeNode_Rcpp_get_tree", (DL_FUNC) &_TreeNode_Rcpp_get_tree, 4},
+    {"_TreeNode_Rcpp_get_trees", (DL_FUNC) &_TreeNode_Rcpp_get_trees, 5},
+    {"_TreeNode_Rcpp_binary_tree_reader_next_chunk", (DL_FUNC) &_TreeNode_Rcpp_binary_tree_reader_next_chunk, 5},
+    {"_TreeNode_Rcpp_close_binary_tree_reader", (DL_FUNC) &_TreeNode_Rcpp_close_binary_tree_reader, 1},
     {"_TreeNode_Rcpp_read_nwka_string", (DL_FUNC) &_TreeNode_Rcpp_read_nwka_string, 2},
     {"_TreeNode_Rcpp_read_nwka_file", (DL_FUNC) &_TreeNode_Rcpp_read_nwka_file, 2},
     {"_TreeNode_Rcpp_read_nexus_file", (DL_FUNC) &_TreeNode_Rcpp_read_nexus_file, 2},
-    {"_TreeNode_Rcpp_write_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_write_binary_trees, 3},
+    {"_TreeNode_Rcpp_write_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_write_binary_trees, 4},
     {"_TreeNode_Rcpp_begin_writing_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_begin_writing_binary_trees, 1},
     {"_TreeNode_Rcpp_write_binary_tree", (DL_FUNC) &_TreeNode_Rcpp_write_binary_tree, 3},
     {"_TreeNode_Rcpp_finish_writing_binary_trees", (DL_FUNC) &_TreeNode_Rcpp_finish_writing_binary_trees, 3},
+    {"_TreeNode_Rcpp_open_binary_tree_writer", (DL_FUNC) &_TreeNode_Rcpp_open_binary_tree_writer, 4},
+    {"_TreeNode_Rcpp_binary_tree_writer_write", (DL_FUNC) &_TreeNode_Rcpp_binary_tree_writer_write, 2},
+    {"_TreeNode_Rcpp_close_binary_tree_writer", (DL_FUNC) &_TreeNode_Rcpp_close_binary_tree_writer, 2},
     {"_TreeNode_Rcpp_multiPhylo_to_string", (DL_FUNC) &_TreeNode_Rcpp_multiPhylo_to_string, 3},
     {"_TreeNode_Rcpp_multiPhylo_to_file", (DL_FUNC) &_TreeNode_Rcpp_multiPhylo_to_file, 5},
     {"_TreeNode_Rcpp_multiPhylo_to_nexus", (DL_FUNC) &_TreeNode_Rcpp_multiPhylo_to_nexus, 4},
@@ -0,0 +1,219 @@
+/***********************************************************************
+ *  binary_input.cpp    2026-10-15
+ *  by Giorgio Bianchini
+ *  This file is part of the R package TreeNode, licensed under GPLv3
+ *
+ *  Input sources used to read files in binary tree format, and other
+ *  platform-specific file operations.
+ ***********************************************************************/
+
+// [[Rcpp::plugins(cpp17)]]
+
+#include "binary_input.h"
+
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Try to memory-map a regular file. Returns false if the file is not a
+//regular file or if it could not be mapped (the caller should then fall
+//back to reading it through a stream).
+#ifdef _WIN32
+static bool mapFile(const std::string& fileName, const byte** data, size_t* size, void** mapping)
+{
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+
+  if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize))
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  if (fileSize.QuadPart == 0)
+  {
+    //Empty files cannot be mapped, but there is nothing to read anyway.
+    CloseHandle(file);
+    *data = NULL;
+    *size = 0;
+    *mapping = NULL;
+    return true;
+  }
+
+  HANDLE fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+
+  if (fileMapping == NULL)
+  {
+    return false;
+  }
+
+  void* view = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(fileMapping);
+
+  if (view == NULL)
+  {
+    return false;
+  }
+
+  *data = (const byte*)view;
+  *size = (size_t)fileSize.QuadPart;
+  *mapping = view;
+  return true;
+}
+
+//Release a mapping created by mapFile (the size is only needed by munmap).
+static void unmapFile(void* mapping, size_t)
+{
+  UnmapViewOfFile(mapping);
+}
+#else
+static bool mapFile(const std::string& fileName, const byte** data, size_t* size, void** mapping)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat info;
+
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+
+  if (info.st_size == 0)
+  {
+    //Empty files cannot be mapped, but there is nothing to read anyway.
+    close(fd);
+    *data = NULL;
+    *size = 0;
+    *mapping = NULL;
+    return true;
+  }
+
+  void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (view == MAP_FAILED)
+  {
+    return false;
+  }
+
+  *data = (const byte*)view;
+  *size = (size_t)info.st_size;
+  *mapping = view;
+  return true;
+}
+
+//Release a mapping created by mapFile.
+static void unmapFile(void* mapping, size_t size)
+{
+  munmap(mapping, size);
+}
+#endif
+
+//Open the file, mapping it in memory if possible, or reading its contents
+//through a std::fstream otherwise.
+BinaryInput::BinaryInput(const std::string& fileName)
+{
+  if (mapFile(fileName, &data, &size, &mapping))
+  {
+    isMapped = true;
+    return;
+  }
+
+  std::fstream file(fileName, std::ios::in | std::ios::binary);
+
+  if (!file.is_open())
+  {
+    throw std::runtime_error("ERROR! Could not open the file for reading.");
+  }
+
+  buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+  file.close();
+
+  data = buffer.data();
+  size = buffer.size();
+  isMapped = false;
+}
+
+BinaryInput::~BinaryInput()
+{
+  if (mapping != NULL)
+  {
+    unmapFile(mapping, size);
+  }
+}
+
+//Bring the specified bytes into memory. On POSIX systems, the operating
+//system is first asked to read the whole range (which allows it to issue
+//large reads); then, one byte in each page is accessed, to make sure that
+//the whole range has actually been read.
+void prefetchBytes(const byte* data, size_t length)
+{
+  if (length == 0)
+  {
+    return;
+  }
+
+#ifndef _WIN32
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)data & ~(uintptr_t)(pageSize - 1);
+  madvise((void*)start, (uintptr_t)data + length - start, MADV_WILLNEED);
+#endif
+
+  volatile byte sink = 0;
+
+  for (size_t i = 0; i < length; i += 4096)
+  {
+    sink = sink ^ data[i];
+  }
+
+  sink = sink ^ data[length - 1];
+}
+
+#ifdef _WIN32
+bool truncateFile(const std::string& fileName, size_t size)
+{
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER position;
+  position.QuadPart = (LONGLONG)size;
+
+  bool tbr = SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+
+  CloseHandle(file);
+
+  return tbr;
+}
+#else
+bool truncateFile(const std::string& fileName, size_t size)
+{
+  return truncate(fileName.c_str(), (off_t)size) == 0;
+}
+#endif
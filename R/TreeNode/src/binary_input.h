@@ -0,0 +1,264 @@
+/***********************************************************************
+ *  binary_input.h    2026-10-15
+ *  by Giorgio Bianchini
+ *  This file is part of the R package TreeNode, licensed under GPLv3
+ *
+ *  Input sources and primitive decoders used to read files in binary
+ *  tree format.
+ ***********************************************************************/
+
+#ifndef TREENODE_BINARY_INPUT_H
+#define TREENODE_BINARY_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//Unsigned byte
+typedef unsigned char byte;
+
+//Read-only view of the contents of a file. Regular files are memory-mapped;
+//inputs that cannot be mapped (e.g. pipes) are read into memory through a
+//std::fstream instead. Either way, the contents are exposed as a contiguous
+//block of bytes. This file does not include Rcpp.h (and neither does
+//binary_input.cpp), because the platform headers needed to map the file are
+//not compatible with the R headers.
+struct BinaryInput
+{
+  //Opens the file. Throws a std::runtime_error if the file cannot be read.
+  BinaryInput(const std::string& fileName);
+  ~BinaryInput();
+
+  BinaryInput(const BinaryInput&) = delete;
+  BinaryInput& operator=(const BinaryInput&) = delete;
+
+  const byte* data = NULL;
+  size_t size = 0;
+
+  //True if the contents are memory-mapped, false if they have been read
+  //into the fallback buffer.
+  bool isMapped = false;
+
+private:
+  std::vector<byte> buffer;
+  void* mapping = NULL;
+};
+
+//A position within a BinaryInput (or any other contiguous block of bytes).
+//Reads should go through the decoders below, which make sure that current
+//never moves past end.
+struct BinaryCursor
+{
+  const byte* start = NULL;
+  const byte* end = NULL;
+  const byte* current = NULL;
+};
+
+//Create a cursor over a block of bytes that is already in memory (e.g. the
+//contents of a raw vector), without copying it.
+inline BinaryCursor makeCursor(const byte* data, size_t size, size_t offset = 0)
+{
+  if (offset > size)
+  {
+    throw std::out_of_range("Invalid offset in the tree file!");
+  }
+
+  BinaryCursor cursor;
+  cursor.start = data;
+  cursor.end = data + size;
+  cursor.current = data + offset;
+  return cursor;
+}
+
+//Create a cursor pointing at the specified offset from the start of the input.
+inline BinaryCursor makeCursor(const BinaryInput* input, size_t offset = 0)
+{
+  return makeCursor(input->data, input->size, offset);
+}
+
+//Move the cursor to the specified offset from the start of the input.
+inline void seekCursor(BinaryCursor* cursor, size_t offset)
+{
+  if (offset > (size_t)(cursor->end - cursor->start))
+  {
+    throw std::out_of_range("Invalid offset in the tree file!");
+  }
+
+  cursor->current = cursor->start + offset;
+}
+
+//Current offset of the cursor from the start of the input.
+inline size_t cursorPosition(const BinaryCursor* cursor)
+{
+  return (size_t)(cursor->current - cursor->start);
+}
+
+//Thrown by the decoders when the data would extend past the end of the input.
+[[noreturn]] inline void throwEndOfFile()
+{
+  throw std::out_of_range("Unexpected end of file!");
+}
+
+//Make sure that at least count bytes can be read from the cursor.
+inline void ensureAvailable(const BinaryCursor* stream, size_t count)
+{
+  if ((size_t)(stream->end - stream->current) < count)
+  {
+    throwEndOfFile();
+  }
+}
+
+//Read a single byte from the input.
+inline byte readByte(BinaryCursor* stream)
+{
+  ensureAvailable(stream, 1);
+
+  return *(stream->current++);
+}
+
+//Read multiple bytes from the input. The returned pointer points within the
+//input and remains valid as long as the input does.
+inline const byte* readBytes(BinaryCursor* stream, size_t count)
+{
+  ensureAvailable(stream, count);
+
+  const byte* tbr = stream->current;
+  stream->current += count;
+
+  return tbr;
+}
+
+//Read a double-precision floating-point number from the input. The
+//numbers are stored in 64-bit IEEE754 format, hopefully this
+//corresponds to the internal format of double on the current platform.
+inline double readDouble(BinaryCursor* stream)
+{
+  double tbr;
+  std::memcpy(&tbr, readBytes(stream, 8), 8);
+
+  return tbr;
+}
+
+//Read a 32-bit (4-byte) wide integer from the input (little-endian).
+inline int32_t readInt32(BinaryCursor* stream)
+{
+  const byte* bytes = readBytes(stream, 4);
+
+  return (int32_t)((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+}
+
+//Read a 64-bit (8-byte) wide integer from the input (little-endian).
+inline int64_t readInt64(BinaryCursor* stream)
+{
+  const byte* bytes = readBytes(stream, 8);
+
+  uint64_t num = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    num |= (uint64_t)bytes[i] << (8 * i);
+  }
+
+  return (int64_t)num;
+}
+
+//Read an integer from the input. If the integer is smaller than 254,
+//it is only 1-byte wide, otherwise it is 40-bit (5-byte) wide.
+inline int32_t readInt(BinaryCursor* stream)
+{
+  byte b = readByte(stream);
+
+  if (b < 254)
+  {
+    return b;
+  }
+  else
+  {
+    return readInt32(stream);
+  }
+}
+
+//Read a string from the input. The string is stored as an integer n
+//representing its length followed by n integers that constitute the
+//UTF-16 representation of the string. Since codecvt_utf8 does not
+//apparently work, we are stuck with a straight int->char conversion,
+//which will probably only work for ASCII characters.
+inline std::string readMyString(BinaryCursor* stream)
+{
+  int32_t length = readInt(stream);
+
+  if (length < 0)
+  {
+    throw std::out_of_range("Invalid string length!");
+  }
+
+  //Each character takes at least one byte: this also guards against
+  //allocating huge strings when reading garbage.
+  ensureAvailable(stream, (size_t)length);
+
+  //If none of the next length bytes starts a 5-byte integer, every
+  //character is stored in a single byte (which is always the case for ASCII
+  //strings) and the string can be copied in bulk.
+  const byte* chars = stream->current;
+  int32_t i = 0;
+
+  while (i < length && chars[i] < 254)
+  {
+    i++;
+  }
+
+  if (i == length)
+  {
+    stream->current += length;
+    return std::string((const char*)chars, length);
+  }
+
+  std::string tbr((const char*)chars, i);
+  tbr.reserve(length);
+  stream->current += i;
+
+  for (; i < length; i++)
+  {
+    tbr.push_back((char)readInt(stream));
+  }
+
+  return tbr;
+}
+
+//Skip a string in the format read by readMyString, without copying it.
+inline void skipMyString(BinaryCursor* stream)
+{
+  int32_t length = readInt(stream);
+
+  if (length < 0)
+  {
+    throw std::out_of_range("Invalid string length!");
+  }
+
+  ensureAvailable(stream, (size_t)length);
+
+  for (int32_t i = 0; i < length; i++)
+  {
+    if (*stream->current < 254)
+    {
+      stream->current++;
+    }
+    else
+    {
+      readInt(stream);
+    }
+  }
+}
+
+//Bring the specified bytes into memory, if they are part of a memory-mapped
+//input, and return once they have been read from the disk. Does nothing
+//useful (but is harmless) for inputs that have been read into memory.
+void prefetchBytes(const byte* data, size_t length);
+
+//Truncate a file to the specified size (in bytes). Returns false if the file
+//could not be truncated.
+bool truncateFile(const std::string& fileName, size_t size);
+
+#endif
@@ -0,0 +1,190 @@
+/***********************************************************************
+ *  binary_output.h    2026-10-15
+ *  by Giorgio Bianchini
+ *  This file is part of the R package TreeNode, licensed under GPLv3
+ *
+ *  Buffered output and primitive encoders used to write files in
+ *  binary tree format.
+ ***********************************************************************/
+
+#ifndef TREENODE_BINARY_OUTPUT_H
+#define TREENODE_BINARY_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+//Unsigned byte
+typedef unsigned char byte;
+
+//Size (in bytes) above which the buffered output is written to the file.
+static const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+//Output that is accumulated in memory and written to a file in large blocks.
+//If file is NULL, the output is only accumulated in the buffer.
+struct BinaryOutput
+{
+  //offset should be the position in the file at which the output starts.
+  BinaryOutput(std::fstream* file = NULL, int64_t offset = 0) : file(file), offset(offset) { }
+
+  std::fstream* file;
+  std::vector<byte> buffer;
+
+  //Position in the file of the first byte in the buffer.
+  int64_t offset;
+};
+
+//Position in the file at which the next byte will be written.
+inline int64_t outputPosition(const BinaryOutput* output)
+{
+  return output->offset + (int64_t)output->buffer.size();
+}
+
+//Write the contents of the buffer to the file and empty it.
+inline void flushOutput(BinaryOutput* output)
+{
+  if (output->file == NULL || output->buffer.empty())
+  {
+    return;
+  }
+
+  output->file->write((const char*)output->buffer.data(), output->buffer.size());
+
+  if (output->file->fail())
+  {
+    throw std::runtime_error("ERROR! Could not write to the file.");
+  }
+
+  output->offset += output->buffer.size();
+  output->buffer.clear();
+}
+
+//Write the contents of the buffer to the file if they exceed
+//OUTPUT_BUFFER_SIZE. This should be called between trees, so that the
+//buffer does not grow indefinitely.
+inline void flushOutputIfFull(BinaryOutput* output)
+{
+  if (output->buffer.size() >= OUTPUT_BUFFER_SIZE)
+  {
+    flushOutput(output);
+  }
+}
+
+//Write a single byte to the output.
+inline void writeByte(BinaryOutput* output, byte b)
+{
+  output->buffer.push_back(b);
+}
+
+//Write multiple bytes to the output.
+inline void writeBytes(BinaryOutput* output, const byte* bytes, size_t count)
+{
+  output->buffer.insert(output->buffer.end(), bytes, bytes + count);
+}
+
+//Write a block of bytes that may be large (e.g. trees copied from another
+//file). Blocks that are larger than the buffer are written straight to the
+//file (after the contents of the buffer), rather than being copied into it.
+inline void copyBytes(BinaryOutput* output, const byte* bytes, size_t count)
+{
+  if (output->file == NULL || count < OUTPUT_BUFFER_SIZE)
+  {
+    writeBytes(output, bytes, count);
+    return;
+  }
+
+  flushOutput(output);
+
+  output->file->write((const char*)bytes, count);
+
+  if (output->file->fail())
+  {
+    throw std::runtime_error("ERROR! Could not write to the file.");
+  }
+
+  output->offset += count;
+}
+
+//Write a double-precision floating point number to the output. The
+//numbers should be stored in 64-bit IEEE754 format, hopefully this
+//corresponds to the internal format of double on the current platform.
+inline void writeDouble(BinaryOutput* output, double value)
+{
+  writeBytes(output, reinterpret_cast<const byte*>(&value), sizeof(value));
+}
+
+//Write a 32-bit wide integer to the output (little-endian).
+inline void writeInt32(BinaryOutput* output, int32_t val)
+{
+  byte buf[4] = { (byte)(val & 0x000000ff),
+                  (byte)((val & 0x0000ff00) >> 8),
+                  (byte)((val & 0x00ff0000) >> 16),
+                  (byte)((val & 0xff000000) >> 24) };
+  writeBytes(output, buf, 4);
+}
+
+//Write a 64-bit wide integer to the output (little-endian).
+inline void writeInt64(BinaryOutput* output, int64_t val)
+{
+  byte buf[8] = { (byte)(val & 0x00000000000000ffLL),
+                  (byte)((val & 0x000000000000ff00LL) >> 8),
+                  (byte)((val & 0x0000000000ff0000LL) >> 16),
+                  (byte)((val & 0x00000000ff000000LL) >> 24),
+                  (byte)((val & 0x000000ff00000000LL) >> 32),
+                  (byte)((val & 0x0000ff0000000000LL) >> 40),
+                  (byte)((val & 0x00ff000000000000LL) >> 48),
+                  (byte)((val & 0xff00000000000000LL) >> 56) };
+  writeBytes(output, buf, 8);
+}
+
+//Write a variable-width integer to the output. If the integer is
+//smaller than 254, it is only 1-byte wide; otherwise it is 40-bit
+//(5-byte) wide.
+inline void writeInt(BinaryOutput* output, int32_t val)
+{
+  if (val < 254)
+  {
+    writeByte(output, (byte)val);
+  }
+  else
+  {
+    writeByte(output, 254);
+    writeInt32(output, val);
+  }
+}
+
+//Write a string to the output. The string should be stored as an
+//integer n representing its length followed by n integers that
+//constitute the UTF-16 representation of the string. Since codecvt_utf8
+//does not apparently work, we are stuck with a straight char->int
+//conversion, which will probably only work for ASCII characters.
+inline void writeMyString(BinaryOutput* output, std::string_view val)
+{
+  writeInt(output, val.length());
+
+  //Characters that are written as a single byte are copied in bulk.
+  //writeInt((int32_t)c) writes a single byte for every value below 254: if
+  //char is signed, this is true of every character (bytes above 127 become
+  //negative, and are written as (byte)c, i.e. unchanged); otherwise, only
+  //bytes 254 and 255 (which never occur in UTF-8) take 5 bytes.
+  size_t i = 0;
+
+  while (i < val.length() && (std::is_signed<char>::value || (byte)val[i] < 254))
+  {
+    i++;
+  }
+
+  writeBytes(output, (const byte*)val.data(), i);
+
+  for (; i < val.length(); i++)
+  {
+    writeInt(output, (int32_t)val[i]);
+  }
+}
+
+#endif
@@ -9,14 +9,15 @@
 // [[Rcpp::plugins(cpp17)]]
 
 #include "common.h"
+#include <thread>
 
 using namespace Rcpp;
 
 //Compare two strings case-insensitively
 //From https://thispointer.com/c-case-insensitive-string-comparison-using-stl-c11-boost-library/
-bool equalCI(std::string& str1, std::string& str2)
+bool equalCI(const std::string& str1, const std::string& str2)
 {
-    return ((str1.size() == str2.size()) && std::equal(str1.begin(), str1.end(), str2.begin(), [](char& c1, char& c2) {
+    return ((str1.size() == str2.size()) && std::equal(str1.begin(), str1.end(), str2.begin(), [](const char& c1, const char& c2) {
         return (c1 == c2 || std::toupper(c1) == std::toupper(c2));
     }));
 }
@@ -34,95 +35,175 @@ bool ci_less::operator() (const std::string& s1, const std::string& s2) const {
      nocase_compare());  // comparison
 }
 
-//Convert a C++ phylo object into an object of class "phylo" that can be passed back to R
-Rcpp::List convertPhylo(phylo tree)
+//Convert an attribute column into an R vector
+static SEXP convertAttributeColumn(std::variant<std::vector<std::string>, std::vector<double>>* column)
 {
-    std::string* tipLabelP = tree.tipLabel.data();
-    Rcpp::StringVector tipLabel(tipLabelP, tipLabelP + tree.tipLabel.size());
+    if (std::holds_alternative<std::vector<double>>(*column))
+    {
+        std::vector<double>* values = &std::get<std::vector<double>>(*column);
+        return Rcpp::NumericVector(values->begin(), values->end());
+    }
+    else
+    {
+        std::vector<std::string>* values = &std::get<std::vector<std::string>>(*column);
+        return Rcpp::CharacterVector(values->begin(), values->end());
+    }
+}
+
+//Convert the names of the tips of a tree into an R vector. Names that are in the shared table (according to
+//sharedIndices) are taken from sharedNames, creating each R string only once; the others are taken from names.
+static Rcpp::CharacterVector convertTipNames(std::vector<std::string>* names, std::vector<int32_t>* sharedIndices, SharedNames* sharedNames)
+{
+    if (sharedIndices->empty() || sharedNames == NULL)
+    {
+        return Rcpp::CharacterVector(names->begin(), names->end());
+    }
+
+    Rcpp::CharacterVector tbr(names->size());
+
+    for (size_t i = 0; i < names->size(); i++)
+    {
+        int32_t index = (*sharedIndices)[i];
 
-    double* edgeLengthP = tree.edgeLength.data();
-    Rcpp::NumericVector edgeLength(edgeLengthP, edgeLengthP + tree.edgeLength.size());
+        if (index >= 0)
+        {
+            if (!sharedNames->created[index])
+            {
+                sharedNames->rNames[index] = (*sharedNames->names)[index];
+                sharedNames->created[index] = true;
+            }
 
-    std::string* nodeLabelP = tree.nodeLabel.data();
-    Rcpp::StringVector nodeLabel(nodeLabelP, nodeLabelP + tree.nodeLabel.size());
+            SET_STRING_ELT(tbr, i, STRING_ELT(sharedNames->rNames, index));
+        }
+        else
+        {
+            tbr[i] = (*names)[i];
+        }
+    }
+
+    return tbr;
+}
+
+//Convert a C++ phylo object into an object of class "phylo" that can be passed back to R.
+//All the R vectors (and the list itself) are allocated once with their final size. If the
+//tip names refer to a table of names shared by multiple trees, this should be provided in
+//sharedNames. Trees that only contain the topology are converted without the attribute lists.
+Rcpp::List convertPhylo(phylo* tree, SharedNames* sharedNames)
+{
+    size_t attributeCount = tree->topologyOnly ? 0 : tree->attributes.size();
 
-    Rcpp::List tipAttributes = Rcpp::List::create();
-    Rcpp::List nodeAttributes = Rcpp::List::create();
+    Rcpp::List tipAttributes(attributeCount);
+    Rcpp::List nodeAttributes(attributeCount);
+    Rcpp::CharacterVector attributeNames(attributeCount);
 
-    std::vector<Attribute> attributes = tree.attributes;
+    int nameAttributeIndex = -1;
 
-    for (size_t i = 0; i < attributes.size(); i++)
+    for (size_t i = 0; i < attributeCount; i++)
     {
-        if (attributes[i].IsNumeric)
+        if (!tree->attributes[i].IsNumeric && equalCI(tree->attributes[i].AttributeName, NAMEATTRIBUTE))
         {
-            double* tipAttributeP = std::get<std::vector<double>>(tree.tipAttributes[i]).data();
-            Rcpp::NumericVector tipAttributeV(tipAttributeP, tipAttributeP + std::get<std::vector<double>>(tree.tipAttributes[i]).size());
-            tipAttributes.push_back(tipAttributeV, attributes[i].AttributeName);
+            nameAttributeIndex = i;
+        }
+    }
+
+    for (size_t i = 0; i < attributeCount; i++)
+    {
+        attributeNames[i] = tree->attributes[i].AttributeName;
 
-            double* nodeAttributeP = std::get<std::vector<double>>(tree.nodeAttributes[i]).data();
-            Rcpp::NumericVector nodeAttributeV(nodeAttributeP, nodeAttributeP + std::get<std::vector<double>>(tree.nodeAttributes[i]).size());
-            nodeAttributes.push_back(nodeAttributeV, attributes[i].AttributeName);
+        if ((int)i == nameAttributeIndex)
+        {
+            tipAttributes[i] = convertTipNames(&std::get<std::vector<std::string>>(tree->tipAttributes[i]), &tree->tipNameIndices, sharedNames);
         }
         else
         {
-            std::string* tipAttributeP = std::get<std::vector<std::string>>(tree.tipAttributes[i]).data();
-            Rcpp::CharacterVector tipAttributeV(tipAttributeP, tipAttributeP + std::get<std::vector<std::string>>(tree.tipAttributes[i]).size());
-            tipAttributes.push_back(tipAttributeV, attributes[i].AttributeName);
-
-            std::string* nodeAttributeP = std::get<std::vector<std::string>>(tree.nodeAttributes[i]).data();
-            Rcpp::CharacterVector nodeAttributeV(nodeAttributeP, nodeAttributeP + std::get<std::vector<std::string>>(tree.nodeAttributes[i]).size());
-            nodeAttributes.push_back(nodeAttributeV, attributes[i].AttributeName);
+            tipAttributes[i] = convertAttributeColumn(&tree->tipAttributes[i]);
         }
+
+        nodeAttributes[i] = convertAttributeColumn(&tree->nodeAttributes[i]);
     }
 
-    Rcpp::IntegerMatrix edge(tree.edge.size(), 2);
+    if (attributeCount > 0)
+    {
+        tipAttributes.attr("names") = attributeNames;
+        nodeAttributes.attr("names") = attributeNames;
+    }
+
+    Rcpp::IntegerMatrix edge(tree->edge.size(), 2);
 
-    for (size_t i = 0; i < tree.edge.size(); i++)
+    for (size_t i = 0; i < tree->edge.size(); i++)
     {
-        edge(i, 0) = tree.edge[i][0] + 1;
-        edge(i, 1) = tree.edge[i][1] + 1;
+        edge(i, 0) = tree->edge[i][0] + 1;
+        edge(i, 1) = tree->edge[i][1] + 1;
     }
 
-    Rcpp::List tbr = Rcpp::List::create(
-        Rcpp::Named("Nnode") = tree.Nnode,
-        Rcpp::Named("tip.label") = tipLabel,
-        Rcpp::Named("tip.attributes") = tipAttributes,
-        Rcpp::Named("node.attributes") = nodeAttributes,
-        Rcpp::Named("edge") = edge
-    );
+    bool hasRootEdge = !std::isnan(tree->rootEdge);
+
+    R_xlen_t elementCount = (tree->topologyOnly ? 3 : 5) + (hasRootEdge ? 1 : 0) + (tree->hasEdgeLength ? 1 : 0) + (tree->hasNodeLabel ? 1 : 0);
+
+    Rcpp::List tbr(elementCount);
+    Rcpp::CharacterVector names(elementCount);
+
+    R_xlen_t index = 0;
 
+    names[index] = "Nnode";
+    tbr[index++] = tree->Nnode;
 
-    if (!std::isnan(tree.rootEdge))
+    names[index] = "tip.label";
+    tbr[index++] = convertTipNames(&tree->tipLabel, &tree->tipNameIndices, sharedNames);
+
+    if (!tree->topologyOnly)
+    {
+        names[index] = "tip.attributes";
+        tbr[index++] = tipAttributes;
+
+        names[index] = "node.attributes";
+        tbr[index++] = nodeAttributes;
+    }
+
+    names[index] = "edge";
+    tbr[index++] = edge;
+
+    if (hasRootEdge)
     {
-        tbr["rootEdge"] = tree.rootEdge;
+        names[index] = "rootEdge";
+        tbr[index++] = tree->rootEdge;
     }
 
-    if (tree.hasEdgeLength)
+    if (tree->hasEdgeLength)
     {
-        tbr["edge.length"] = edgeLength;
+        names[index] = "edge.length";
+        tbr[index++] = Rcpp::NumericVector(tree->edgeLength.begin(), tree->edgeLength.end());
     }
 
-    if (tree.hasNodeLabel)
+    if (tree->hasNodeLabel)
     {
-        tbr["node.label"] = nodeLabel;
+        names[index] = "node.label";
+        tbr[index++] = Rcpp::CharacterVector(tree->nodeLabel.begin(), tree->nodeLabel.end());
     }
 
+    tbr.attr("names") = names;
     tbr.attr("class") = "phylo";
     tbr.attr("order") = "cladewise";
 
     return tbr;
 }
 
-//Convert a C++ multiPhylo object (list of trees) into an object of class "multiPhylo" that can be passed back to R
-Rcpp::List convertMultiPhylo(multiPhylo* trees)
+//Convert a C++ multiPhylo object (list of trees) into an object of class "multiPhylo" that can be passed back to R.
+//Each tree is released as soon as it has been converted, so that only one copy of most trees exists at any time.
+//If the tip names refer to a table of names shared by the trees, this should be provided in sharedNames.
+Rcpp::List convertMultiPhylo(multiPhylo* trees, SharedNames* sharedNames)
 {
-    Rcpp::List treeList = Rcpp::List::create();
+    Rcpp::List treeList(trees->trees.size());
+    Rcpp::CharacterVector treeNames(trees->trees.size());
 
     for (size_t i = 0; i < trees->trees.size(); i++)
     {
-        treeList.push_back(convertPhylo(trees->trees[i]), trees->treeNames[i]);
+        treeList[i] = convertPhylo(&trees->trees[i], sharedNames);
+        treeNames[i] = trees->treeNames[i];
+        trees->trees[i] = phylo();
     }
 
+    treeList.attr("names") = treeNames;
     treeList.attr("class") = "multiPhylo";
 
     return treeList;
@@ -438,7 +519,7 @@ phylo convertTree(Rcpp::List* tree)
 
     for (R_xlen_t i = 0; i < edge.nrow(); i++)
     {
-        std::vector<int32_t> row(2);
+        std::array<int32_t, 2> row;
         row[0] = edge(i, 0);
         row[1] = edge(i, 1);
         tbr.edge.push_back(row);
@@ -523,3 +604,14 @@ multiPhylo convertTrees(Rcpp::List* trees)
 
     return tbr;
 }
+
+//Resolve the number of threads requested from R: 0 or negative values mean one thread for each available core.
+int resolveThreads(int threads)
+{
+    if (threads <= 0)
+    {
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    return threads;
+}
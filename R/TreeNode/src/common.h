@@ -7,8 +7,10 @@
  ***********************************************************************/
 
 #include <Rcpp.h>
+#include <array>
 #include <fstream>
 #include <variant>
+#include "binary_output.h"
 
 //Unsigned byte
 typedef unsigned char byte;
@@ -31,7 +33,7 @@ struct phylo
 {
     int32_t Nnode = -1;
     double rootEdge = std::nan("");
-    std::vector<std::vector<int32_t>> edge;
+    std::vector<std::array<int32_t, 2>> edge;
     std::vector<std::string> tipLabel;
     std::vector<std::string> nodeLabel;
     std::vector<double> edgeLength;
@@ -40,6 +42,15 @@ struct phylo
     std::vector<Attribute> attributes;
     bool hasEdgeLength = false;
     bool hasNodeLabel = false;
+
+    //If this is not empty, it contains the index of the name of each tip within a table of names shared by
+    //multiple trees (see SharedNames), or -1 if the name of the tip is not in the table. Names that are in
+    //the table are replaced by empty strings in tipLabel and in the tip values of the Name attribute.
+    std::vector<int32_t> tipNameIndices;
+
+    //If this is true, the tree only contains the topology and the tip labels (plus the TreeName attribute, if
+    //present, which is only used to name the tree), and it is converted without the attribute lists.
+    bool topologyOnly = false;
 };
 
 //Represents a list of phylogenetic trees with names
@@ -49,6 +60,38 @@ struct multiPhylo
     std::vector<std::string> treeNames;
 };
 
+//Represents the metadata of a file in binary tree format
+struct BinaryTreeMetadata
+{
+    bool globalNames = false;
+    bool globalAttributes = false;
+
+    //If this is true, the global names and attributes are stored in a block referenced by the trailer,
+    //rather than in the header.
+    bool deferredGlobals = false;
+
+    bool validTrailer = false;
+    std::vector<std::string> names;
+    std::vector<Attribute> attributes;
+    std::vector<int64_t> treeAddresses;
+
+    //Addresses of the trailer and of the global dictionary block (or -1 if the file does not have them).
+    int64_t trailerAddress = -1;
+    int64_t dictionaryAddress = -1;
+};
+
+//A table of names shared by multiple trees (e.g. the global names of a file in binary tree format), together
+//with the corresponding R strings. Each R string is created the first time it is needed, and then reused for
+//all the trees that refer to the same name.
+struct SharedNames
+{
+    SharedNames(const std::vector<std::string>* names) : names(names), rNames(names->size()), created(names->size(), false) { }
+
+    const std::vector<std::string>* names;
+    Rcpp::CharacterVector rNames;
+    std::vector<bool> created;
+};
+
 //From https://stackoverflow.com/questions/1801892/how-can-i-make-the-mapfind-operation-case-insensitive
 /************************************************************************/
 /* Comparator for case-insensitive comparison in STL assos. containers  */
@@ -66,9 +109,9 @@ struct ci_less
 };
 
 //In common.cpp [see comments there]
-bool equalCI(std::string& str1, std::string& str2);
-Rcpp::List convertPhylo(phylo tree);
-Rcpp::List convertMultiPhylo(multiPhylo* trees);
+bool equalCI(const std::string& str1, const std::string& str2);
+Rcpp::List convertPhylo(phylo* tree, SharedNames* sharedNames = NULL);
+Rcpp::List convertMultiPhylo(multiPhylo* trees, SharedNames* sharedNames = NULL);
 bool tryParse(std::string val, double* output = NULL);
 int attributeIndex(std::vector<Attribute>* attributes, Attribute* attribute);
 int32_t addChildren(std::vector<std::vector<int32_t>>* children, std::vector<int32_t>* sortedParents, std::vector<std::vector<int32_t>>* sortedChildren, std::vector<int32_t>* sortedNodes, int32_t* currIndex, int32_t currNonSortedIndex, int32_t currSortedParent);
@@ -77,3 +120,10 @@ std::vector<std::variant<std::vector<std::string>, std::vector<double>>> convert
 phylo convertTree(Rcpp::List* tree);
 void setTreeName(phylo* tree, std::string name);
 multiPhylo convertTrees(Rcpp::List* trees);
+int resolveThreads(int threads);
+
+//In write_binary_tree.cpp [see comments there]
+void finishWritingBinaryTrees(BinaryOutput* file, std::vector<int64_t>* addresses, const byte* additionalDataToCopy, size_t additionalDataToCopySize, int64_t dictionaryAddress = -1);
+void appendBinaryTrees(multiPhylo* trees, BinaryOutput* file, const BinaryTreeMetadata* metadata, byte* additionalDataToCopy, size_t additionalDataToCopySize);
+void writeGlobalNames(BinaryOutput* file, const std::vector<std::string_view>* names);
+void writeGlobalAttributes(BinaryOutput* file, const std::vector<Attribute>* attributes);
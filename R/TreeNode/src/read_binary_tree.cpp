@@ -1,844 +1,2166 @@
-/***********************************************************************
- *  read_binary_tree.cpp    2020-05-20
- *  by Giorgio Bianchini
- *  This file is part of the R package TreeNode, licensed under GPLv3
- *
- *  Methods to read trees from a file in binary tree format and pass
- *  them to R.
- ***********************************************************************/
-
-// [[Rcpp::plugins(cpp17)]]
-
-#include "common.h"
-
-//Read a single byte from the stream.
-static byte readByte(std::fstream* stream)
-{
-  byte buffer[1];
-  stream->read((char*)buffer, 1);
-
-  return buffer[0];
-}
-
-//Read multiple bytes from the stream.
-static std::vector<byte> readBytes(std::fstream* stream, int count)
-{
-  std::vector<byte> buffer(count);
-  stream->read((char*)buffer.data(), count);
-
-  return buffer;
-}
-
-//Read a double-precision floating-point number from the stream. The
-//numbers are stored in 64-bit IEEE754 format, hopefully this
-//corresponds to the internal format of double on the current platform.
-static double readDouble(std::fstream* stream)
-{
-  double buffer[1];
-
-  stream->read((char*)&buffer, 8);
-
-  return buffer[0];
-}
-
-//Read a 32-bit (4-byte) wide integer from the stream (little-endian).
-static int32_t readInt32(std::fstream* stream)
-{
-  std::vector<byte> bytes = readBytes(stream, 4);
-
-  int32_t num = 0;
-  for (int i = 0; i < 4; i++)
-  {
-    num += bytes[i] << (8 * i);
-  }
-
-  return num;
-}
-
-//Read a 64-bit (8-byte) wide integer from the stream (little-endian).
-static int64_t readInt64(std::fstream* stream)
-{
-  std::vector<byte> bytes = readBytes(stream, 8);
-
-  int64_t num = 0;
-  for (int i = 0; i < 8; i++)
-  {
-    num += (int64_t)bytes[i] << (8 * i);
-  }
-
-  return num;
-}
-
-//Read an integer from the stream. If the integer is smaller than 254,
-//it is only 1-byte wide, otherwise it is 40-bit (5-byte) wide.
-static int32_t readInt(std::fstream* stream)
-{
-  unsigned char b = readByte(stream);
-
-  if (b < 254)
-  {
-    return(b);
-  }
-  else
-  {
-    return readInt32(stream);
-  }
-}
-
-//Read a string from the stream. The string is stored as an integer n
-//representing its length followed by n integers that constitute the
-//UTF-16 representation of the string. Since codecvt_utf8 does not
-//apparently work, we are stuck with a straight int->char conversion,
-//which will probably only work for ASCII characters.
-static std::string readMyString(std::fstream* stream)
-{
-  int32_t length = readInt(stream);
-
-  std::vector<char> chars(length);
-
-  for (int i = 0; i < length; i++)
-  {
-    chars[i] = (char)readInt(stream);
-  }
-
-  /*std::wstring_convert<std::codecvt_utf8<uint16_t>, uint16_t> conversion;
-   uint16_t* p = chars.data();
-   std::string tbr = conversion.to_bytes(p, p + length);*/
-
-  std::string tbrStd(chars.data(), length);
-
-  return tbrStd;
-}
-
-//Read a variable-width integer from the stream. If the integer is equal
-//to 0, 2 or 3, it is 2-bit wide; if it is 1, 4 or 5, it is 4-bit wide;
-//if it is greater than 5, the current byte is padded and the integer is
-//represented as an integer of the format read by readInt in the
-//following byte(s). The initial value of *currByte should be read
-//using readByte and the initial value of *currIndex should be 0.
-//Successive reads should use the same variables, which will have been
-//updated by this method. After the last read, if *currIndex is equal to
-//0, it means that *currByte has not been processed (thus you should
-//seek back by 1).
-static int32_t readShortInt(std::fstream* stream, byte* currByte, int* currIndex)
-{
-  if (*currIndex == 0)
-  {
-    int32_t twoBits = *currByte & 0b00000011;
-
-    *currIndex = 2;
-
-    if (twoBits == 0b00)
-    {
-      return 0;
-    }
-    else if (twoBits == 0b01)
-    {
-      return 2;
-    }
-    else if (twoBits == 0b10)
-    {
-      return 3;
-    }
-    else// if (twoBits == 0b11)
-    {
-      int32_t fourBits = *currByte & 0b00001111;
-      *currIndex = 4;
-
-      if (fourBits == 0b0011)
-      {
-        return 1;
-      }
-      else if (fourBits == 0b0111)
-      {
-        return 4;
-      }
-      else if (fourBits == 0b1011)
-      {
-        return 5;
-      }
-      else// if (fourBits == 0b1111)
-      {
-        int32_t tbr = readInt(stream);
-        *currByte = readByte(stream);
-        *currIndex = 0;
-        return tbr;
-      }
-    }
-  }
-  else if (*currIndex == 2)
-  {
-    int32_t twoBits = (*currByte & 0b00001100) >> 2;
-
-    *currIndex = 4;
-
-    if (twoBits == 0b00)
-    {
-      return 0;
-    }
-    else if (twoBits == 0b01)
-    {
-      return 2;
-    }
-    else if (twoBits == 0b10)
-    {
-      return 3;
-    }
-    else// if (twoBits == 0b11)
-    {
-      int32_t fourBits = (*currByte & 0b00111100) >> 2;
-      *currIndex = 6;
-
-      if (fourBits == 0b0011)
-      {
-        return 1;
-      }
-      else if (fourBits == 0b0111)
-      {
-        return 4;
-      }
-      else if (fourBits == 0b1011)
-      {
-        return 5;
-      }
-      else// if (fourBits == 0b1111)
-      {
-        int32_t tbr = readInt(stream);
-        *currByte = readByte(stream);
-        *currIndex = 0;
-        return tbr;
-      }
-    }
-  }
-  else if (*currIndex == 4)
-  {
-    int32_t twoBits = (*currByte & 0b00110000) >> 4;
-
-    *currIndex = 6;
-
-    if (twoBits == 0b00)
-    {
-      return 0;
-    }
-    else if (twoBits == 0b01)
-    {
-      return 2;
-    }
-    else if (twoBits == 0b10)
-    {
-      return 3;
-    }
-    else// if (twoBits == 0b11)
-    {
-      int32_t fourBits = (*currByte & 0b11110000) >> 4;
-      *currIndex = 0;
-
-      if (fourBits == 0b0011)
-      {
-        *currByte = readByte(stream);
-        return 1;
-      }
-      else if (fourBits == 0b0111)
-      {
-        *currByte = readByte(stream);
-        return 4;
-      }
-      else if (fourBits == 0b1011)
-      {
-        *currByte = readByte(stream);
-        return 5;
-      }
-      else// if (fourBits == 0b1111)
-      {
-        int32_t tbr = readInt(stream);
-        *currByte = readByte(stream);
-        *currIndex = 0;
-        return tbr;
-      }
-    }
-  }
-  else //if (*currIndex == 6)
-  {
-    int32_t twoBits = (*currByte & 0b11000000) >> 6;
-
-    *currIndex = 0;
-    *currByte = readByte(stream);
-
-    if (twoBits == 0b00)
-    {
-      return 0;
-    }
-    else if (twoBits == 0b01)
-    {
-      return 2;
-    }
-    else if (twoBits == 0b10)
-    {
-      return 3;
-    }
-    else// if (twoBits == 0b11)
-    {
-      int32_t fourBits = twoBits | ((*currByte & 0b00000011) << 2);
-      *currIndex = 2;
-
-      if (fourBits == 0b0011)
-      {
-        return 1;
-      }
-      else if (fourBits == 0b0111)
-      {
-        return 4;
-      }
-      else if (fourBits == 0b1011)
-      {
-        return 5;
-      }
-      else// if (fourBits == 0b1111)
-      {
-        int32_t tbr = readInt(stream);
-        *currByte = readByte(stream);
-        *currIndex = 0;
-        return tbr;
-      }
-    }
-  }
-}
-
-//Read a single tree in binary format from the file stream.
-static phylo readBinaryTree(std::fstream* file, bool globalNames = false, std::vector<std::string> names = std::vector<std::string>(), std::vector<Attribute> attributes = std::vector<Attribute>())
-{
-  int32_t numAttributes = readInt(file);
-
-  if (numAttributes > 0)
-  {
-    attributes = std::vector<Attribute>(numAttributes);
-
-    for (int i = 0; i < numAttributes; i++)
-    {
-      attributes[i].AttributeName = readMyString(file);
-      attributes[i].IsNumeric = readInt(file) == 2;
-    }
-  }
-
-  std::vector<int32_t> parents;
-  std::vector<std::vector<int32_t>> children;
-  std::vector<int32_t> addedChildren;
-
-  int32_t currParent = 0;
-
-  parents.push_back(-1);
-  addedChildren.push_back(0);
-
-  int32_t tipCount = 0;
-
-  byte currByte = readByte(file);
-  int32_t currIndex = 0;
-
-  while (currParent >= 0)
-  {
-    int32_t currCount = readShortInt(file, &currByte, &currIndex);
-
-    children.push_back(std::vector<int32_t>(currCount));
-
-    if (currCount == 0)
-    {
-      tipCount++;
-    }
-
-    while (currParent >= 0 && children[currParent].size() == (size_t)addedChildren[currParent])
-    {
-      currParent = parents[currParent];
-    }
-
-    if (currParent >= 0)
-    {
-      int newNode = parents.size();
-      children[currParent][addedChildren[currParent]] = newNode;
-      addedChildren[currParent]++;
-      parents.push_back(currParent);
-      addedChildren.push_back(0);
-      currParent = newNode;
-    }
-  }
-
-  if (currIndex == 0)
-  {
-    file->seekg(-1, std::ios_base::cur);
-  }
-
-  int32_t nodeCount = parents.size();
-  std::vector<double> edgeLengths(nodeCount, std::nan(""));
-  std::vector<double> nodeSupport(nodeCount, std::nan(""));
-  std::vector<std::string> nodeNames(nodeCount);
-
-  std::vector<std::vector<std::variant<std::string, double>>> nodeAttributes(attributes.size());
-
-  int32_t nameAttributeIndex = -1;
-  int32_t supportAttributeIndex = -1;
-
-  for (size_t i = 0; i < attributes.size(); i++)
-  {
-    nodeAttributes[i] = std::vector<std::variant<std::string, double>>(nodeCount);
-
-    if (attributes[i].IsNumeric)
-    {
-      for (int32_t j = 0; j < nodeCount; j++)
-      {
-        nodeAttributes[i][j] = std::nan("");
-      }
-    }
-    else
-    {
-      for (int32_t j = 0; j < nodeCount; j++)
-      {
-        nodeAttributes[i][j] = "";
-      }
-    }
-
-    if (equalCI(attributes[i].AttributeName, NAMEATTRIBUTE) && !attributes[i].IsNumeric)
-    {
-      nameAttributeIndex = i;
-    }
-    else if (equalCI(attributes[i].AttributeName, SUPPORTATTRIBUTE) && attributes[i].IsNumeric)
-    {
-      supportAttributeIndex = i;
-    }
-  }
-
-  for (int i = 0; i < nodeCount; i++)
-  {
-    int32_t attributeCount = readInt(file);
-
-    for (int j = 0; j < attributeCount; j++)
-    {
-      int32_t attributeIndex = readInt(file);
-
-      std::string attributeName = attributes[attributeIndex].AttributeName;
-
-      bool isNumeric = attributes[attributeIndex].IsNumeric;
-
-      if (isNumeric)
-      {
-        if (equalCI(attributeName, LENGTHATTRIBUTE))
-        {
-          edgeLengths[i] = readDouble(file);
-          nodeAttributes[attributeIndex][i] = edgeLengths[i];
-        }
-        else if (equalCI(attributeName, SUPPORTATTRIBUTE))
-        {
-          nodeSupport[i] = readDouble(file);
-          nodeAttributes[attributeIndex][i] = nodeSupport[i];
-        }
-        else
-        {
-          nodeAttributes[attributeIndex][i] = readDouble(file);
-        }
-      }
-      else if (!equalCI(attributeName, NAMEATTRIBUTE))
-      {
-        nodeAttributes[attributeIndex][i] = readMyString(file);
-      }
-      else
-      {
-        if (!globalNames)
-        {
-          nodeNames[i] = readMyString(file);
-        }
-        else
-        {
-          byte b = readByte(file);
-
-          if (b == 0)
-          {
-            nodeNames[i] = "";
-          }
-          else if (b <= 254)
-          {
-            file->seekg(-1, std::ios::cur);
-            int32_t index = readInt(file);
-            nodeNames[i] = names[index - 1];
-          }
-          else //if (b == 255)
-          {
-            nodeNames[i] = readMyString(file);
-          }
-        }
-
-        nodeAttributes[attributeIndex][i] = nodeNames[i];
-      }
-    }
-  }
-
-  std::vector<int32_t> correspondences(nodeCount);
-  std::vector<std::string> tipLabels(tipCount);
-  std::vector<std::string> nodeLabels(nodeCount - tipCount);
-
-  std::vector<std::variant<std::vector<std::string>, std::vector<double>>> internalNodeAttributes(attributes.size());
-  std::vector<std::variant<std::vector<std::string>, std::vector<double>>> tipAttributes(attributes.size());
-
-  for (size_t i = 0; i < attributes.size(); i++)
-  {
-    if (attributes[i].IsNumeric)
-    {
-      internalNodeAttributes[i] = std::vector<double>(nodeCount - tipCount);
-      tipAttributes[i] = std::vector<double>(tipCount);
-    }
-    else
-    {
-      internalNodeAttributes[i] = std::vector<std::string>(nodeCount - tipCount);
-      tipAttributes[i] = std::vector<std::string>(tipCount);
-    }
-  }
-
-  int32_t tipIndex = -1;
-  int32_t nonTipIndex = -1;
-
-  for (int i = 0; i < nodeCount; i++)
-  {
-    if (children[i].size() == 0)
-    {
-      tipIndex++;
-      correspondences[i] = tipIndex;
-      tipLabels[tipIndex] = nodeNames[i];
-
-      for (size_t j = 0; j < attributes.size(); j++)
-      {
-        if (attributes[j].IsNumeric)
-        {
-          std::get<std::vector<double>>(tipAttributes[j])[tipIndex] = std::get<double>(nodeAttributes[j][i]);
-        }
-        else
-        {
-          std::get<std::vector<std::string>>(tipAttributes[j])[tipIndex] = std::get<std::string>(nodeAttributes[j][i]);
-        }
-      }
-    }
-    else
-    {
-      nonTipIndex++;
-      correspondences[i] = nonTipIndex + tipCount;
-
-      for (size_t j = 0; j < attributes.size(); j++)
-      {
-        if (attributes[j].IsNumeric)
-        {
-          std::get<std::vector<double>>(internalNodeAttributes[j])[nonTipIndex] = std::get<double>(nodeAttributes[j][i]);
-        }
-        else
-        {
-          std::get<std::vector<std::string>>(internalNodeAttributes[j])[nonTipIndex] = std::get<std::string>(nodeAttributes[j][i]);
-        }
-      }
-    }
-  }
-
-  std::vector<std::vector<int32_t>> edges(nodeCount - 1);
-  std::vector<double> correspEdgeLengths(nodeCount - 1);
-
-  for (int i = 1; i < nodeCount; i++)
-  {
-    edges[i - 1] = std::vector<int32_t>(2);
-
-    edges[i - 1][0] = correspondences[parents[i]];
-    edges[i - 1][1] = correspondences[i];
-    correspEdgeLengths[i - 1] = edgeLengths[i];
-  }
-
-  phylo tbr;
-
-  tbr.Nnode = nodeCount - tipCount;
-  tbr.edge = edges;
-  tbr.tipLabel = tipLabels;
-  tbr.edgeLength = correspEdgeLengths;
-
-  for (int i = 0; i < nodeCount - 1; i++)
-  {
-    if (!std::isnan(correspEdgeLengths[i]))
-    {
-      tbr.hasEdgeLength = true;
-      break;
-    }
-  }
-
-  tbr.tipAttributes = tipAttributes;
-  tbr.nodeAttributes = internalNodeAttributes;
-  tbr.attributes = attributes;
-
-  tbr.rootEdge = edgeLengths[0];
-
-  bool found = false;
-
-  if (nameAttributeIndex >= 0)
-  {
-    for (size_t i = 0; i < std::get<std::vector<std::string>>(internalNodeAttributes[nameAttributeIndex]).size(); i++)
-    {
-      if (std::get<std::vector<std::string>>(internalNodeAttributes[nameAttributeIndex])[i] != "")
-      {
-        found = true;
-        break;
-      }
-    }
-  }
-
-  if (found)
-  {
-    tbr.nodeLabel = std::get<std::vector<std::string>>(internalNodeAttributes[nameAttributeIndex]);
-    tbr.hasNodeLabel = true;
-  }
-  else if (supportAttributeIndex >= 0)
-  {
-    for (size_t i = 0; i < std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex]).size(); i++)
-    {
-      if (std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex])[i] > 0)
-      {
-        found = true;
-        break;
-      }
-    }
-
-    if (found)
-    {
-      tbr.nodeLabel = std::vector<std::string>(std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex]).size());
-
-      for (size_t i = 0; i < std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex]).size(); i++)
-      {
-        tbr.nodeLabel[i] = std::to_string(std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex])[i]);
-      }
-
-      tbr.hasNodeLabel = true;
-    }
-  }
-
-  return tbr;
-}
-
-//Check whether the tree has a valid trailer.
-static bool hasValidTrailer(std::fstream* file)
-{
-  std::streampos currPos = file->tellg();
-  file->seekg(-4, std::ios::end);
-
-  std::vector<byte> trailer = readBytes(file, 4);
-
-  file->seekg(currPos, std::ios::beg);
-
-  return trailer[0] == 0x45 && trailer[1] == 0x4e && trailer[2] == 0x44 && trailer[3] == 0xff;
-}
-
-//Read multiple trees in binary format from a file stream.
-static multiPhylo readBinaryTrees(std::fstream* file)
-{
-  std::vector<byte> header = readBytes(file, 4);
-
-  if (header[0] != 0x23 || header[1] != 0x54 || header[2] != 0x52 || header[3] != 0x45)
-  {
-    Rcpp::stop("Invalid file header!");
-  }
-
-  byte headerByte = readByte(file);
-
-  if ((headerByte & 0xfc) != 0)
-  {
-    Rcpp::stop("Invalid file header!");
-  }
-  bool globalNames = (headerByte & 0x01) != 0;
-
-  bool globalAttributes = (headerByte & 0x02) != 0;
-
-  bool validTrailer = hasValidTrailer(file);
-
-  std::vector<int64_t> treeAddresses;
-
-  if (validTrailer)
-  {
-    file->seekg(-12, std::ios::end);
-
-    int64_t labelAddress = readInt64(file);
-
-    file->seekg(labelAddress, std::ios::beg);
-
-    int32_t numOfTrees = readInt(file);
-
-    treeAddresses = std::vector<int64_t>(numOfTrees);
-
-    for (int i = 0; i < numOfTrees; i++)
-    {
-      treeAddresses[i] = readInt64(file);
-    }
-  }
-
-  file->seekg(5, std::ios::beg);
-
-  std::vector<std::string> allNames;
-
-  if (globalNames)
-  {
-    int32_t numNames = readInt(file);
-    allNames = std::vector<std::string>(numNames);
-
-    for (int i = 0; i < numNames; i++)
-    {
-      allNames[i] = readMyString(file);
-    }
-  }
-
-  std::vector<Attribute> allAttributes;
-
-  if (globalAttributes)
-  {
-    int32_t numAttributes = readInt(file);
-    allAttributes = std::vector<Attribute>(numAttributes);
-
-    for (int i = 0; i < numAttributes; i++)
-    {
-      allAttributes[i].AttributeName = readMyString(file);
-      allAttributes[i].IsNumeric = readInt(file) == 2;
-    }
-  }
-
-  if (validTrailer)
-  {
-    std::vector<phylo> parsedTrees;
-
-    std::vector<std::string> treeNames;
-
-    for (size_t i = 0; i < treeAddresses.size(); i++)
-    {
-      file->seekg(treeAddresses[i], std::ios::beg);
-      phylo tree = readBinaryTree(file, globalNames, allNames, allAttributes);
-
-      std::string treeName = "tree" + std::to_string(i + 1);
-
-      int treeNameIndex = -1;
-
-      for (size_t j = 0; j < tree.attributes.size(); j++)
-      {
-        if (equalCI(tree.attributes[j].AttributeName, TREENAMEATTRIBUTE))
-        {
-          treeNameIndex = j;
-          break;
-        }
-      }
-
-      if (treeNameIndex >= 0 && tree.nodeAttributes.size() > 0 && std::get<std::vector<std::string>>(tree.nodeAttributes[treeNameIndex])[0] != "")
-      {
-        treeName = std::get<std::vector<std::string>>(tree.nodeAttributes[treeNameIndex])[0];
-      }
-
-      parsedTrees.push_back(tree);
-      treeNames.push_back(treeName);
-    }
-
-    multiPhylo tbr;
-
-    tbr.trees = parsedTrees;
-    tbr.treeNames = treeNames;
-
-    return tbr;
-  }
-  else
-  {
-    Rcpp::warning("Invalid file trailer!");
-
-    bool error = false;
-
-    std::vector<phylo> parsedTrees;
-
-    std::vector<std::string> treeNames;
-
-    int i = 0;
-
-    while (!error)
-    {
-      phylo tree;
-
-      try
-      {
-        tree = readBinaryTree(file, globalNames, allNames, allAttributes);
-      }
-      catch ( ... )
-      {
-        error = true;
-      }
-
-      if (!error)
-      {
-        i++;
-
-        std::string treeName = "tree" + std::to_string(i);
-
-        int treeNameIndex = -1;
-
-        for (size_t j = 0; j < tree.attributes.size(); j++)
-        {
-          if (equalCI(tree.attributes[j].AttributeName, TREENAMEATTRIBUTE))
-          {
-            treeNameIndex = j;
-            break;
-          }
-        }
-
-        if (treeNameIndex >= 0 && tree.nodeAttributes.size() > 0 && std::get<std::vector<std::string>>(tree.nodeAttributes[treeNameIndex])[0] != "")
-        {
-          treeName = std::get<std::vector<std::string>>(tree.nodeAttributes[treeNameIndex])[0];
-        }
-
-        parsedTrees.push_back(tree);
-        treeNames.push_back(treeName);
-      }
-    }
-
-    multiPhylo tbr;
-
-    tbr.trees = parsedTrees;
-    tbr.treeNames = treeNames;
-
-    return tbr;
-  }
-}
-
-//Read a single tree in binary format from a file and pass it back to R.
-// [[Rcpp::export]]
-SEXP Rcpp_read_binary_tree(std::string fileName, long offset, bool globalNames, std::vector<std::string> names, std::vector<std::string> attributeNames, std::vector<bool> attributesAreNumeric)
-{
- std::vector<Attribute> attributes(attributeNames.size());
-
- for (size_t i = 0; i < attributeNames.size(); i++)
- {
-   attributes[i].AttributeName = attributeNames[i];
-   attributes[i].IsNumeric = attributesAreNumeric[i];
- }
-
- std::fstream file(fileName, std::ios::in | std::ios::binary);
-
- if (!file.is_open())
- {
-   Rcpp::stop("ERROR! Could not open the file for reading.");
- }
-
- file.seekg(offset);
-
- phylo tree = readBinaryTree(&file, globalNames, names, attributes);
-
- file.close();
-
- return Rcpp::wrap(convertPhylo(tree));
-}
-
-//Read multiple trees in binary format from a file and pass them back to R.
-// [[Rcpp::export]]
-SEXP Rcpp_read_binary_trees(std::string fileName)
-{
-  std::fstream file(fileName, std::ios::in | std::ios::binary);
-
-  if (!file.is_open())
-  {
-    Rcpp::stop("ERROR! Could not open the file for reading.");
-  }
-
-  multiPhylo trees = readBinaryTrees(&file);
-
-  file.close();
-
-  return Rcpp::wrap(convertMultiPhylo(&trees));
-}
+/***********************************************************************
+ *  read_binary_tree.cpp    2020-05-20
+ *  by Giorgio Bianchini
+ *  This file is part of the R package TreeNode, licensed under GPLv3
+ *
+ *  Methods to read trees from a file in binary tree format and pass
+ *  them to R.
+ ***********************************************************************/
+
+// [[Rcpp::plugins(cpp17)]]
+
+#include "common.h"
+#include "binary_input.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+//What follows the short ints that have been decoded from a byte.
+enum ShortIntTail : byte
+{
+  //The next short int starts at the beginning of the next byte.
+  SHORTINT_NEXT_BYTE = 0,
+
+  //The byte ended with the 0b1111 code: the next short int is stored as an
+  //integer (in the format read by readInt) in the following byte(s).
+  SHORTINT_ESCAPE = 1,
+
+  //The two most significant bits of the byte are the first half (0b11) of
+  //a 4-bit short int, which is completed by the two least significant bits
+  //of the next byte.
+  SHORTINT_SPLIT = 2
+};
+
+//The short ints packed in one byte, starting from a certain bit.
+struct ShortIntTableEntry
+{
+  byte count = 0;
+  byte values[4] = { 0, 0, 0, 0 };
+  ShortIntTail tail = SHORTINT_NEXT_BYTE;
+};
+
+//Lookup table used to decode the short ints packed in each possible byte.
+//The first row is used when the byte is read from the start; the second
+//row when the first two bits of the byte have already been consumed
+//(i.e. after a SHORTINT_SPLIT).
+struct ShortIntTable
+{
+  ShortIntTableEntry entries[2][256];
+};
+
+//Values represented by the 2-bit codes 0b00, 0b01 and 0b10.
+static const byte shortIntTwoBitValues[3] = { 0, 2, 3 };
+
+//Values represented by the 4-bit codes 0b0011, 0b0111 and 0b1011 (indexed
+//by the two most significant bits of the code).
+static const byte shortIntFourBitValues[3] = { 1, 4, 5 };
+
+//Build the lookup table used by readShortInt.
+static ShortIntTable buildShortIntTable()
+{
+  ShortIntTable table;
+
+  for (int row = 0; row < 2; row++)
+  {
+    for (int b = 0; b < 256; b++)
+    {
+      ShortIntTableEntry* entry = &table.entries[row][b];
+      int bit = row * 2;
+
+      while (bit < 8)
+      {
+        int twoBits = (b >> bit) & 0b11;
+
+        if (twoBits != 0b11)
+        {
+          entry->values[entry->count++] = shortIntTwoBitValues[twoBits];
+          bit += 2;
+        }
+        else if (bit == 6)
+        {
+          entry->tail = SHORTINT_SPLIT;
+          break;
+        }
+        else
+        {
+          int highBits = (b >> (bit + 2)) & 0b11;
+
+          if (highBits == 0b11)
+          {
+            entry->tail = SHORTINT_ESCAPE;
+            break;
+          }
+
+          entry->values[entry->count++] = shortIntFourBitValues[highBits];
+          bit += 4;
+        }
+      }
+    }
+  }
+
+  return table;
+}
+
+//State of the decoder used to read a stream of short ints. A new (default
+//initialised) ShortIntReader should be used for each stream.
+struct ShortIntReader
+{
+  byte values[4];
+  byte count = 0;
+  byte next = 0;
+  ShortIntTail tail = SHORTINT_NEXT_BYTE;
+};
+
+//Read a variable-width integer from the input. If the integer is equal
+//to 0, 2 or 3, it is 2-bit wide; if it is 1, 4 or 5, it is 4-bit wide;
+//if it is greater than 5, the current byte is padded and the integer is
+//represented as an integer of the format read by readInt in the
+//following byte(s). Successive reads should use the same *state, which
+//will have been updated by this method. Each byte is decoded at once
+//using a lookup table, and the cursor is never moved past the last byte
+//containing data for the short ints that have been returned.
+static int32_t readShortInt(BinaryCursor* stream, ShortIntReader* state)
+{
+  static const ShortIntTable table = buildShortIntTable();
+
+  while (state->next >= state->count)
+  {
+    if (state->tail == SHORTINT_ESCAPE)
+    {
+      state->count = 0;
+      state->next = 0;
+      state->tail = SHORTINT_NEXT_BYTE;
+      return readInt(stream);
+    }
+    else if (state->tail == SHORTINT_SPLIT)
+    {
+      byte b = readByte(stream);
+      int highBits = b & 0b11;
+
+      if (highBits == 0b11)
+      {
+        state->count = 0;
+        state->next = 0;
+        state->tail = SHORTINT_NEXT_BYTE;
+        return readInt(stream);
+      }
+
+      const ShortIntTableEntry* entry = &table.entries[1][b];
+      std::memcpy(state->values, entry->values, 4);
+      state->count = entry->count;
+      state->next = 0;
+      state->tail = entry->tail;
+
+      return shortIntFourBitValues[highBits];
+    }
+    else
+    {
+      const ShortIntTableEntry* entry = &table.entries[0][readByte(stream)];
+      std::memcpy(state->values, entry->values, 4);
+      state->count = entry->count;
+      state->next = 0;
+      state->tail = entry->tail;
+    }
+  }
+
+  return state->values[state->next++];
+}
+
+//Options determining which parts of the trees are decoded.
+struct BinaryTreeReadOptions
+{
+  //If this is true, only the attributes whose names (compared
+  //case-insensitively) are in selectedAttributes (and the TreeName attribute)
+  //are decoded; the values of the other attributes are skipped.
+  bool selectAttributes = false;
+  std::vector<std::string> selectedAttributes;
+
+  //If this is true, only the topology and the tip names are decoded: the
+  //values of all the other attributes (including the names of internal
+  //nodes, but not the TreeName attribute) are skipped, and the tree has no
+  //branch lengths, node labels or attribute lists. This overrides
+  //selectedAttributes.
+  bool topologyOnly = false;
+};
+
+//Determine whether an attribute should be decoded according to the options.
+static bool isAttributeSelected(const BinaryTreeReadOptions* options, const Attribute* attribute)
+{
+  //The TreeName attribute is always needed to name the tree.
+  if (!attribute->IsNumeric && equalCI(attribute->AttributeName, TREENAMEATTRIBUTE))
+  {
+    return true;
+  }
+
+  if (options != NULL && options->topologyOnly)
+  {
+    return !attribute->IsNumeric && equalCI(attribute->AttributeName, NAMEATTRIBUTE);
+  }
+
+  if (options == NULL || !options->selectAttributes)
+  {
+    return true;
+  }
+
+  for (size_t i = 0; i < options->selectedAttributes.size(); i++)
+  {
+    if (equalCI(options->selectedAttributes[i], attribute->AttributeName))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//Move the cursor past the value of an attribute of a node, without decoding
+//it. isName should be true if the attribute is the (non-numeric) Name
+//attribute and the file has global names, in which case nameCount is the
+//number of global names.
+static void skipAttributeValue(BinaryCursor* file, bool isNumeric, bool isName, size_t nameCount)
+{
+  if (isNumeric)
+  {
+    readBytes(file, 8);
+  }
+  else if (!isName)
+  {
+    skipMyString(file);
+  }
+  else
+  {
+    byte b = readByte(file);
+
+    if (b == 255)
+    {
+      skipMyString(file);
+    }
+    else if (b != 0)
+    {
+      file->current--;
+      int32_t index = readInt(file);
+
+      if (index < 1 || (size_t)index > nameCount)
+      {
+        throw std::out_of_range("Invalid name index!");
+      }
+    }
+  }
+}
+
+//Read a single tree in binary format from the input, using the global names
+//and attributes from the metadata of the file (which are accessed in place,
+//and never copied). If options is provided, only the attributes selected by
+//the options are decoded. Tip names that are stored as references to the
+//global names are returned as indices in tipNameIndices, rather than as
+//copies of the strings.
+static phylo readBinaryTree(BinaryCursor* file, const BinaryTreeMetadata* metadata, const BinaryTreeReadOptions* options = NULL)
+{
+  bool topologyOnly = options != NULL && options->topologyOnly;
+  bool globalNames = metadata->globalNames;
+  const std::vector<std::string>* names = &metadata->names;
+
+  int32_t numAttributes = readInt(file);
+
+  std::vector<Attribute> treeAttributes;
+  const std::vector<Attribute>* allAttributes = &metadata->attributes;
+
+  if (numAttributes > 0)
+  {
+    treeAttributes = std::vector<Attribute>(numAttributes);
+
+    for (int i = 0; i < numAttributes; i++)
+    {
+      treeAttributes[i].AttributeName = readMyString(file);
+      treeAttributes[i].IsNumeric = readInt(file) == 2;
+    }
+
+    allAttributes = &treeAttributes;
+  }
+
+  //The attributes that are decoded, and the position of each attribute among
+  //them (or -1 if its values should be skipped).
+  std::vector<Attribute> attributes;
+  std::vector<int32_t> attributeColumns(allAttributes->size(), -1);
+  std::vector<bool> attributeIsName(allAttributes->size());
+
+  for (size_t i = 0; i < allAttributes->size(); i++)
+  {
+    attributeIsName[i] = globalNames && !(*allAttributes)[i].IsNumeric && equalCI((*allAttributes)[i].AttributeName, NAMEATTRIBUTE);
+
+    if (isAttributeSelected(options, &(*allAttributes)[i]))
+    {
+      attributeColumns[i] = attributes.size();
+      attributes.push_back((*allAttributes)[i]);
+    }
+  }
+
+  //The nodes are numbered in the order in which they appear in the topology
+  //(i.e. depth-first). openNodes contains the nodes whose children have not
+  //all been read yet, and missingChildren how many children each of them is
+  //still missing.
+  std::vector<int32_t> parents;
+  std::vector<int32_t> childCounts;
+  std::vector<int32_t> openNodes;
+  std::vector<int32_t> missingChildren;
+
+  int32_t tipCount = 0;
+
+  ShortIntReader shortInts;
+
+  do
+  {
+    int32_t node = parents.size();
+
+    if (openNodes.empty())
+    {
+      parents.push_back(-1);
+    }
+    else
+    {
+      parents.push_back(openNodes.back());
+      missingChildren.back()--;
+    }
+
+    int32_t currCount = readShortInt(file, &shortInts);
+
+    if (currCount < 0)
+    {
+      throw std::out_of_range("Invalid number of children!");
+    }
+
+    childCounts.push_back(currCount);
+
+    if (currCount == 0)
+    {
+      tipCount++;
+    }
+    else
+    {
+      openNodes.push_back(node);
+      missingChildren.push_back(currCount);
+    }
+
+    while (!openNodes.empty() && missingChildren.back() == 0)
+    {
+      openNodes.pop_back();
+      missingChildren.pop_back();
+    }
+  }
+  while (!openNodes.empty());
+
+  int32_t nodeCount = parents.size();
+
+  //Tips are numbered from 0 to tipCount - 1 and internal nodes from tipCount
+  //to nodeCount - 1, in the order in which they appear in the topology.
+  std::vector<int32_t> correspondences(nodeCount);
+
+  int32_t tipIndex = 0;
+  int32_t nonTipIndex = tipCount;
+
+  for (int32_t i = 0; i < nodeCount; i++)
+  {
+    correspondences[i] = childCounts[i] == 0 ? tipIndex++ : nonTipIndex++;
+  }
+
+  phylo tbr;
+
+  tbr.Nnode = nodeCount - tipCount;
+  tbr.edge = std::vector<std::array<int32_t, 2>>(nodeCount - 1);
+
+  if (!topologyOnly)
+  {
+    tbr.edgeLength = std::vector<double>(nodeCount - 1, std::nan(""));
+  }
+
+  for (int32_t i = 1; i < nodeCount; i++)
+  {
+    tbr.edge[i - 1][0] = correspondences[parents[i]];
+    tbr.edge[i - 1][1] = correspondences[i];
+  }
+
+  //The attribute values are decoded straight into the columns of the final
+  //tree, for the tips and the internal nodes respectively.
+  std::vector<std::variant<std::vector<std::string>, std::vector<double>>> tipAttributes(attributes.size());
+  std::vector<std::variant<std::vector<std::string>, std::vector<double>>> internalNodeAttributes(attributes.size());
+
+  std::vector<double*> numericTipColumns(attributes.size(), NULL);
+  std::vector<double*> numericNodeColumns(attributes.size(), NULL);
+  std::vector<std::string*> stringTipColumns(attributes.size(), NULL);
+  std::vector<std::string*> stringNodeColumns(attributes.size(), NULL);
+
+  std::vector<bool> isLengthAttribute(attributes.size());
+  std::vector<bool> isNameAttribute(attributes.size());
+
+  int32_t nameAttributeIndex = -1;
+  int32_t supportAttributeIndex = -1;
+
+  for (size_t i = 0; i < attributes.size(); i++)
+  {
+    if (attributes[i].IsNumeric)
+    {
+      tipAttributes[i] = std::vector<double>(tipCount, std::nan(""));
+      internalNodeAttributes[i] = std::vector<double>(nodeCount - tipCount, std::nan(""));
+      numericTipColumns[i] = std::get<std::vector<double>>(tipAttributes[i]).data();
+      numericNodeColumns[i] = std::get<std::vector<double>>(internalNodeAttributes[i]).data();
+
+      isLengthAttribute[i] = equalCI(attributes[i].AttributeName, LENGTHATTRIBUTE);
+
+      if (equalCI(attributes[i].AttributeName, SUPPORTATTRIBUTE))
+      {
+        supportAttributeIndex = i;
+      }
+    }
+    else
+    {
+      tipAttributes[i] = std::vector<std::string>(tipCount);
+      internalNodeAttributes[i] = std::vector<std::string>(nodeCount - tipCount);
+      stringTipColumns[i] = std::get<std::vector<std::string>>(tipAttributes[i]).data();
+      stringNodeColumns[i] = std::get<std::vector<std::string>>(internalNodeAttributes[i]).data();
+
+      isNameAttribute[i] = equalCI(attributes[i].AttributeName, NAMEATTRIBUTE);
+
+      if (isNameAttribute[i])
+      {
+        nameAttributeIndex = i;
+      }
+    }
+  }
+
+  //Tip names that refer to the global names are stored as indices.
+  if (globalNames && nameAttributeIndex >= 0)
+  {
+    tbr.tipNameIndices = std::vector<int32_t>(tipCount, -1);
+  }
+
+  for (int32_t i = 0; i < nodeCount; i++)
+  {
+    bool isTip = childCounts[i] == 0;
+    int32_t index = isTip ? correspondences[i] : correspondences[i] - tipCount;
+
+    int32_t attributeCount = readInt(file);
+
+    for (int j = 0; j < attributeCount; j++)
+    {
+      int32_t attributeIndex = readInt(file);
+
+      if (attributeIndex < 0 || (size_t)attributeIndex >= attributeColumns.size())
+      {
+        throw std::out_of_range("Invalid attribute index!");
+      }
+
+      if (attributeColumns[attributeIndex] < 0 || (topologyOnly && !isTip && attributeColumns[attributeIndex] == nameAttributeIndex))
+      {
+        skipAttributeValue(file, (*allAttributes)[attributeIndex].IsNumeric, attributeIsName[attributeIndex], names->size());
+        continue;
+      }
+
+      attributeIndex = attributeColumns[attributeIndex];
+
+      if (attributes[attributeIndex].IsNumeric)
+      {
+        double value = readDouble(file);
+
+        (isTip ? numericTipColumns : numericNodeColumns)[attributeIndex][index] = value;
+
+        if (isLengthAttribute[attributeIndex])
+        {
+          if (i > 0)
+          {
+            tbr.edgeLength[i - 1] = value;
+          }
+          else
+          {
+            tbr.rootEdge = value;
+          }
+        }
+      }
+      else
+      {
+        std::string* value = &(isTip ? stringTipColumns : stringNodeColumns)[attributeIndex][index];
+
+        if (!isNameAttribute[attributeIndex] || !globalNames)
+        {
+          *value = readMyString(file);
+        }
+        else
+        {
+          bool sharedTipName = isTip && attributeIndex == nameAttributeIndex;
+
+          if (sharedTipName)
+          {
+            tbr.tipNameIndices[index] = -1;
+          }
+
+          byte b = readByte(file);
+
+          if (b == 0)
+          {
+            *value = "";
+          }
+          else if (b <= 254)
+          {
+            file->current--;
+            int32_t nameIndex = readInt(file);
+
+            if (nameIndex < 1 || (size_t)nameIndex > names->size())
+            {
+              throw std::out_of_range("Invalid name index!");
+            }
+
+            if (sharedTipName)
+            {
+              tbr.tipNameIndices[index] = nameIndex - 1;
+            }
+            else
+            {
+              *value = (*names)[nameIndex - 1];
+            }
+          }
+          else //if (b == 255)
+          {
+            *value = readMyString(file);
+          }
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < tbr.edgeLength.size(); i++)
+  {
+    if (!std::isnan(tbr.edgeLength[i]))
+    {
+      tbr.hasEdgeLength = true;
+      break;
+    }
+  }
+
+  if (nameAttributeIndex >= 0 && topologyOnly)
+  {
+    //The attribute columns are discarded, so the names can be moved.
+    tbr.tipLabel = std::move(std::get<std::vector<std::string>>(tipAttributes[nameAttributeIndex]));
+  }
+  else if (nameAttributeIndex >= 0)
+  {
+    tbr.tipLabel = std::get<std::vector<std::string>>(tipAttributes[nameAttributeIndex]);
+  }
+  else
+  {
+    tbr.tipLabel = std::vector<std::string>(tipCount);
+  }
+
+  if (topologyOnly)
+  {
+    //Only the TreeName attribute is kept (if present), so that the tree can
+    //be named.
+    for (size_t i = 0; i < attributes.size(); i++)
+    {
+      if ((int32_t)i != nameAttributeIndex)
+      {
+        tbr.tipAttributes.push_back(std::move(tipAttributes[i]));
+        tbr.nodeAttributes.push_back(std::move(internalNodeAttributes[i]));
+        tbr.attributes.push_back(attributes[i]);
+      }
+    }
+
+    tbr.topologyOnly = true;
+    return tbr;
+  }
+
+  bool found = false;
+
+  if (nameAttributeIndex >= 0)
+  {
+    std::vector<std::string>* nodeNames = &std::get<std::vector<std::string>>(internalNodeAttributes[nameAttributeIndex]);
+
+    for (size_t i = 0; i < nodeNames->size(); i++)
+    {
+      if ((*nodeNames)[i] != "")
+      {
+        found = true;
+        break;
+      }
+    }
+
+    if (found)
+    {
+      tbr.nodeLabel = *nodeNames;
+      tbr.hasNodeLabel = true;
+    }
+  }
+
+  if (!found && supportAttributeIndex >= 0)
+  {
+    std::vector<double>* nodeSupport = &std::get<std::vector<double>>(internalNodeAttributes[supportAttributeIndex]);
+
+    for (size_t i = 0; i < nodeSupport->size(); i++)
+    {
+      if ((*nodeSupport)[i] > 0)
+      {
+        found = true;
+        break;
+      }
+    }
+
+    if (found)
+    {
+      tbr.nodeLabel = std::vector<std::string>(nodeSupport->size());
+
+      for (size_t i = 0; i < nodeSupport->size(); i++)
+      {
+        tbr.nodeLabel[i] = std::to_string((*nodeSupport)[i]);
+      }
+
+      tbr.hasNodeLabel = true;
+    }
+  }
+
+  tbr.tipAttributes = std::move(tipAttributes);
+  tbr.nodeAttributes = std::move(internalNodeAttributes);
+  tbr.attributes = std::move(attributes);
+
+  return tbr;
+}
+
+//Move the cursor past a single tree in binary format, without building the
+//tree. This checks the structure of the tree in the same way as
+//readBinaryTree (and throws an exception if the tree is incomplete or
+//invalid), but it does not store the topology, and attribute values are
+//skipped rather than decoded.
+static void skipBinaryTree(BinaryCursor* file, BinaryTreeMetadata* metadata)
+{
+  int32_t numAttributes = readInt(file);
+
+  std::vector<Attribute> treeAttributes;
+  std::vector<Attribute>* attributes = &metadata->attributes;
+
+  if (numAttributes > 0)
+  {
+    treeAttributes = std::vector<Attribute>(numAttributes);
+
+    for (int i = 0; i < numAttributes; i++)
+    {
+      treeAttributes[i].AttributeName = readMyString(file);
+      treeAttributes[i].IsNumeric = readInt(file) == 2;
+    }
+
+    attributes = &treeAttributes;
+  }
+
+  std::vector<bool> isName(attributes->size());
+
+  for (size_t i = 0; i < attributes->size(); i++)
+  {
+    isName[i] = metadata->globalNames && !(*attributes)[i].IsNumeric && equalCI((*attributes)[i].AttributeName, NAMEATTRIBUTE);
+  }
+
+  //Every node in the topology is followed by its children, thus the topology
+  //ends after (1 + the sum of all the child counts) nodes have been read.
+  int64_t nodeCount = 0;
+  int64_t expectedNodes = 1;
+
+  ShortIntReader shortInts;
+
+  while (nodeCount < expectedNodes)
+  {
+    int32_t currCount = readShortInt(file, &shortInts);
+
+    if (currCount < 0)
+    {
+      throw std::out_of_range("Invalid number of children!");
+    }
+
+    expectedNodes += currCount;
+    nodeCount++;
+  }
+
+  for (int64_t i = 0; i < nodeCount; i++)
+  {
+    int32_t attributeCount = readInt(file);
+
+    for (int j = 0; j < attributeCount; j++)
+    {
+      int32_t attributeIndex = readInt(file);
+
+      if (attributeIndex < 0 || (size_t)attributeIndex >= attributes->size())
+      {
+        throw std::out_of_range("Invalid attribute index!");
+      }
+
+      skipAttributeValue(file, (*attributes)[attributeIndex].IsNumeric, isName[attributeIndex], metadata->names.size());
+    }
+  }
+}
+
+//Check whether the tree has a valid trailer.
+static bool hasValidTrailer(BinaryCursor* file)
+{
+  if (file->end - file->start < 4)
+  {
+    return false;
+  }
+
+  const byte* trailer = file->end - 4;
+
+  return trailer[0] == 0x45 && trailer[1] == 0x4e && trailer[2] == 0x44 && trailer[3] == 0xff;
+}
+
+//Get the name of a tree from its TreeName attribute or, if this is missing,
+//generate a default name from the index of the tree (starting from 0).
+static std::string getTreeName(phylo* tree, size_t index)
+{
+  int treeNameIndex = -1;
+
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    if (equalCI(tree->attributes[j].AttributeName, TREENAMEATTRIBUTE))
+    {
+      treeNameIndex = j;
+      break;
+    }
+  }
+
+  if (treeNameIndex >= 0 && tree->nodeAttributes.size() > 0 && std::get<std::vector<std::string>>(tree->nodeAttributes[treeNameIndex])[0] != "")
+  {
+    return std::get<std::vector<std::string>>(tree->nodeAttributes[treeNameIndex])[0];
+  }
+  else
+  {
+    return "tree" + std::to_string(index + 1);
+  }
+}
+
+//Read the global names and attributes (if the file has them) starting from
+//the current position of the cursor.
+static void readGlobals(BinaryCursor* file, BinaryTreeMetadata* metadata)
+{
+  metadata->names.clear();
+
+  if (metadata->globalNames)
+  {
+    int32_t numNames = readInt(file);
+    metadata->names = std::vector<std::string>(numNames);
+
+    for (int i = 0; i < numNames; i++)
+    {
+      metadata->names[i] = readMyString(file);
+    }
+  }
+
+  metadata->attributes.clear();
+
+  if (metadata->globalAttributes)
+  {
+    int32_t numAttributes = readInt(file);
+    metadata->attributes = std::vector<Attribute>(numAttributes);
+
+    for (int i = 0; i < numAttributes; i++)
+    {
+      metadata->attributes[i].AttributeName = readMyString(file);
+      metadata->attributes[i].IsNumeric = readInt(file) == 2;
+    }
+  }
+}
+
+//Move the cursor past the global names and attributes (if the file has them),
+//without decoding them.
+static void skipGlobals(BinaryCursor* file, const BinaryTreeMetadata* metadata)
+{
+  if (metadata->globalNames)
+  {
+    int32_t numNames = readInt(file);
+
+    for (int i = 0; i < numNames; i++)
+    {
+      skipMyString(file);
+    }
+  }
+
+  if (metadata->globalAttributes)
+  {
+    int32_t numAttributes = readInt(file);
+
+    for (int i = 0; i < numAttributes; i++)
+    {
+      skipMyString(file);
+      readInt(file);
+    }
+  }
+}
+
+//Read the metadata of a file in binary tree format: the header (including any
+//global names and attributes) and, if the file has a valid trailer, the
+//addresses of the trees. If the global names and attributes are stored in a
+//dictionary block referenced by the trailer, they are read from there (and the
+//file cannot be read without a valid trailer). After this method returns, the
+//cursor points at the start of the first tree.
+static void readBinaryTreeMetadata(BinaryCursor* file, BinaryTreeMetadata* metadata)
+{
+  seekCursor(file, 0);
+
+  const byte* header = readBytes(file, 4);
+
+  if (header[0] != 0x23 || header[1] != 0x54 || header[2] != 0x52 || header[3] != 0x45)
+  {
+    Rcpp::stop("Invalid file header!");
+  }
+
+  byte headerByte = readByte(file);
+
+  if ((headerByte & 0xf8) != 0)
+  {
+    Rcpp::stop("Invalid file header!");
+  }
+
+  metadata->globalNames = (headerByte & 0x01) != 0;
+
+  metadata->globalAttributes = (headerByte & 0x02) != 0;
+
+  metadata->deferredGlobals = (headerByte & 0x04) != 0;
+
+  metadata->validTrailer = hasValidTrailer(file);
+
+  metadata->treeAddresses.clear();
+  metadata->trailerAddress = -1;
+  metadata->dictionaryAddress = -1;
+
+  int64_t dictionaryAddress = 5;
+
+  if (metadata->validTrailer)
+  {
+    file->current = file->end - 12;
+
+    int64_t labelAddress = readInt64(file);
+
+    seekCursor(file, labelAddress);
+
+    metadata->trailerAddress = labelAddress;
+
+    int32_t numOfTrees = readInt(file);
+
+    //Check that the addresses fit in the file before allocating them, so that
+    //a corrupt trailer cannot request a huge (or negative) allocation.
+    if (numOfTrees < 0 || (size_t)numOfTrees > (size_t)(file->end - file->current) / 8)
+    {
+      Rcpp::stop("Invalid file trailer!");
+    }
+
+    metadata->treeAddresses = std::vector<int64_t>(numOfTrees);
+
+    for (int i = 0; i < numOfTrees; i++)
+    {
+      metadata->treeAddresses[i] = readInt64(file);
+    }
+
+    if (metadata->deferredGlobals)
+    {
+      dictionaryAddress = readInt64(file);
+      metadata->dictionaryAddress = dictionaryAddress;
+    }
+  }
+  else if (metadata->deferredGlobals)
+  {
+    Rcpp::stop("The global names and attributes of this file are stored in the trailer, which is missing or invalid!");
+  }
+
+  seekCursor(file, dictionaryAddress);
+
+  readGlobals(file, metadata);
+
+  //If the global names and attributes are not in the header, the first tree
+  //starts right after it.
+  if (metadata->deferredGlobals)
+  {
+    seekCursor(file, 5);
+  }
+}
+
+//Determine the addresses of the trees in a file without a valid trailer, by
+//skipping trees one after the other until the end of the file (or until the
+//first tree that is incomplete or invalid), or until maxTrees trees have been
+//found. The cursor should point at the start of the first tree; when this
+//method returns, it points at the end of the last tree that has been found.
+static std::vector<int64_t> scanTreeAddresses(BinaryCursor* file, BinaryTreeMetadata* metadata, size_t maxTrees = SIZE_MAX)
+{
+  std::vector<int64_t> treeAddresses;
+
+  while (file->current < file->end && treeAddresses.size() < maxTrees)
+  {
+    const byte* address = file->current;
+
+    try
+    {
+      skipBinaryTree(file, metadata);
+    }
+    catch ( ... )
+    {
+      file->current = address;
+      break;
+    }
+
+    treeAddresses.push_back(address - file->start);
+  }
+
+  return treeAddresses;
+}
+
+//Create the read options from the attribute names provided by R. If
+//attributes is NULL, all the attributes are decoded. If topologyOnly is true,
+//only the topology and the tip names are decoded.
+static BinaryTreeReadOptions getReadOptions(SEXP attributes, bool topologyOnly)
+{
+  BinaryTreeReadOptions options;
+
+  options.topologyOnly = topologyOnly;
+
+  if (!Rf_isNull(attributes))
+  {
+    options.selectAttributes = true;
+    options.selectedAttributes = Rcpp::as<std::vector<std::string>>(attributes);
+  }
+
+  return options;
+}
+
+//The trees that should be read from a file: either the trees with the
+//specified (1-based) indices, or the trees from index from to index to
+//(inclusive), taking one every by trees. If to is negative, the range extends
+//to the last tree in the file.
+struct BinaryTreeSelection
+{
+  bool useIndices = false;
+  std::vector<int> indices;
+  int from = 1;
+  int to = -1;
+  int by = 1;
+};
+
+//Determine how many trees need to be found in a file in order to read the
+//selected trees.
+static size_t selectionEnd(const BinaryTreeSelection* selection)
+{
+  if (selection == NULL || selection->useIndices || selection->to < 0)
+  {
+    return SIZE_MAX;
+  }
+
+  return (size_t)selection->to;
+}
+
+//Get the (0-based) indices of the selected trees in a file containing
+//treeCount trees. Parts of the range that lie beyond the end of the file are
+//ignored, while explicit indices must refer to trees in the file.
+static std::vector<size_t> selectTrees(const BinaryTreeSelection* selection, size_t treeCount)
+{
+  std::vector<size_t> tbr;
+
+  if (selection == NULL)
+  {
+    tbr = std::vector<size_t>(treeCount);
+
+    for (size_t i = 0; i < treeCount; i++)
+    {
+      tbr[i] = i;
+    }
+  }
+  else if (selection->useIndices)
+  {
+    tbr = std::vector<size_t>(selection->indices.size());
+
+    for (size_t i = 0; i < selection->indices.size(); i++)
+    {
+      if (selection->indices[i] < 1 || (size_t)selection->indices[i] > treeCount)
+      {
+        Rcpp::stop("Invalid tree index: " + std::to_string(selection->indices[i]) + "!");
+      }
+
+      tbr[i] = selection->indices[i] - 1;
+    }
+  }
+  else
+  {
+    if (selection->from < 1)
+    {
+      Rcpp::stop("Invalid first tree index: " + std::to_string(selection->from) + "!");
+    }
+
+    if (selection->by < 1)
+    {
+      Rcpp::stop("Invalid tree index increment: " + std::to_string(selection->by) + "!");
+    }
+
+    size_t last = std::min(selectionEnd(selection), treeCount);
+
+    for (size_t i = selection->from; i <= last; i += selection->by)
+    {
+      tbr.push_back(i - 1);
+    }
+  }
+
+  return tbr;
+}
+
+//Maximum number of bytes that the read-ahead thread brings into memory beyond
+//the tree that is currently being decoded.
+static const size_t READ_AHEAD_BYTES = 64 * 1024 * 1024;
+
+//The read-ahead thread is only used if the trees that are being read span at
+//least this many bytes.
+static const size_t READ_AHEAD_THRESHOLD = 16 * 1024 * 1024;
+
+//Determine the number of bytes occupied by each of the trees in the file (in
+//the same order as the addresses in the metadata): each tree extends until
+//the start of the next tree in the file or, for the last tree, until the
+//global dictionary block or the trailer (or the end of the input, if the
+//file does not have a valid trailer). This
+//should be computed once for each file (after the addresses of the trees have
+//been determined), rather than every time some trees are read.
+static std::vector<size_t> getTreeLengths(BinaryCursor* file, const BinaryTreeMetadata* metadata)
+{
+  const std::vector<int64_t>* treeAddresses = &metadata->treeAddresses;
+  std::vector<int64_t> sortedAddresses = *treeAddresses;
+
+  if (!std::is_sorted(sortedAddresses.begin(), sortedAddresses.end()))
+  {
+    std::sort(sortedAddresses.begin(), sortedAddresses.end());
+  }
+
+  int64_t inputSize = file->end - file->start;
+
+  int64_t treesEnd = inputSize;
+
+  if (metadata->dictionaryAddress >= 0)
+  {
+    treesEnd = metadata->dictionaryAddress;
+  }
+  else if (metadata->trailerAddress >= 0)
+  {
+    treesEnd = metadata->trailerAddress;
+  }
+
+  std::vector<size_t> tbr(treeAddresses->size());
+
+  for (size_t i = 0; i < treeAddresses->size(); i++)
+  {
+    int64_t address = (*treeAddresses)[i];
+    std::vector<int64_t>::iterator next = std::upper_bound(sortedAddresses.begin(), sortedAddresses.end(), address);
+    int64_t end = next != sortedAddresses.end() ? *next : std::max(treesEnd, address);
+
+    tbr[i] = (size_t)(std::min(end, inputSize) - std::min(address, inputSize));
+  }
+
+  return tbr;
+}
+
+//Read the trees with the specified (0-based) indices and store each of them at
+//the same position as its index in *parsedTrees (which should already have the
+//same size as *indices). treeLengths should contain the length of every tree
+//in the file, as returned by getTreeLengths. If threads is greater than 1, the trees are read
+//in parallel: each thread reads the next tree that has not been claimed yet,
+//using its own cursor over the input. If reading any of the trees fails, the
+//first exception is rethrown after all the threads have stopped. The worker
+//threads must not call into R.
+//If the input is memory-mapped (isMapped) and the trees span a large part of
+//it, a read-ahead thread brings the bytes of the next trees into memory (up to READ_AHEAD_BYTES beyond the last
+//tree that has been claimed), so that the disk is reading the upcoming trees
+//while the current ones are being decoded, rather than each page of the
+//memory-mapped file being read only when a decoder needs it.
+static void readBinaryTreesAt(BinaryCursor* file, bool isMapped, const std::vector<size_t>* indices, int threads, BinaryTreeMetadata* metadata, const std::vector<size_t>* treeLengths, const BinaryTreeReadOptions* options, std::vector<phylo>* parsedTrees)
+{
+  size_t treeCount = indices->size();
+
+  std::vector<int64_t> treeAddresses(treeCount);
+
+  //Offset of each tree (and of the end of the last tree) if all the trees
+  //were laid out one after the other, in the order in which they are read.
+  std::vector<size_t> cumulativeLengths(treeCount + 1, 0);
+
+  for (size_t i = 0; i < treeCount; i++)
+  {
+    treeAddresses[i] = metadata->treeAddresses[(*indices)[i]];
+    cumulativeLengths[i + 1] = cumulativeLengths[i] + (*treeLengths)[(*indices)[i]];
+  }
+
+  bool readAhead = isMapped && cumulativeLengths[treeCount] >= READ_AHEAD_THRESHOLD;
+
+  if (!readAhead && (threads <= 1 || treeCount <= 1))
+  {
+    for (size_t i = 0; i < treeCount; i++)
+    {
+      seekCursor(file, treeAddresses[i]);
+      (*parsedTrees)[i] = readBinaryTree(file, metadata, options);
+    }
+
+    return;
+  }
+
+  std::atomic<size_t> nextTree(0);
+  std::atomic<bool> failed(false);
+  std::exception_ptr error = NULL;
+  std::mutex errorMutex;
+
+  std::atomic<bool> finished(false);
+  std::mutex progressMutex;
+  std::condition_variable progress;
+
+  auto worker = [&]()
+  {
+    BinaryCursor cursor = *file;
+
+    try
+    {
+      for (size_t i = nextTree++; i < treeCount && !failed; i = nextTree++)
+      {
+        if (readAhead)
+        {
+          progress.notify_one();
+        }
+
+        seekCursor(&cursor, treeAddresses[i]);
+        (*parsedTrees)[i] = readBinaryTree(&cursor, metadata, options);
+      }
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(errorMutex);
+
+      if (!failed)
+      {
+        error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  auto readAheadWorker = [&]()
+  {
+    for (size_t i = 0; i < treeCount && !finished; i++)
+    {
+      {
+        std::unique_lock<std::mutex> lock(progressMutex);
+
+        //The timeout makes up for notifications that are missed because
+        //they happen while this thread is not waiting.
+        while (!finished && cumulativeLengths[i] >= cumulativeLengths[std::min(nextTree.load(), treeCount)] + READ_AHEAD_BYTES)
+        {
+          progress.wait_for(lock, std::chrono::milliseconds(10));
+        }
+      }
+
+      if (!finished && cumulativeLengths[i + 1] > cumulativeLengths[i])
+      {
+        prefetchBytes(file->start + treeAddresses[i], cumulativeLengths[i + 1] - cumulativeLengths[i]);
+      }
+    }
+  };
+
+  std::thread readAheadThread;
+
+  if (readAhead)
+  {
+    readAheadThread = std::thread(readAheadWorker);
+  }
+
+  if (threads <= 1 || treeCount <= 1)
+  {
+    worker();
+  }
+  else
+  {
+    std::vector<std::thread> workers;
+
+    for (int i = 0; i < threads && (size_t)i < treeCount; i++)
+    {
+      workers.push_back(std::thread(worker));
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      workers[i].join();
+    }
+  }
+
+  if (readAhead)
+  {
+    {
+      std::lock_guard<std::mutex> lock(progressMutex);
+      finished = true;
+    }
+
+    progress.notify_one();
+    readAheadThread.join();
+  }
+
+  if (failed)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+//Read multiple trees in binary format from the input. If the input does not
+//have a valid trailer, the addresses of the trees are determined by scanning
+//it first. If threads is greater than 1, the trees are decoded in parallel.
+//If selection is provided, only the selected trees are decoded; the others
+//are never built. The metadata of the file are stored in *metadata, which
+//should be kept until the trees have been converted (their tip names may
+//refer to the global names). isMapped should be true if the input is a
+//memory-mapped file.
+static multiPhylo readBinaryTrees(BinaryCursor* file, BinaryTreeMetadata* metadata, int threads = 1, const BinaryTreeReadOptions* options = NULL, const BinaryTreeSelection* selection = NULL, bool isMapped = false)
+{
+  readBinaryTreeMetadata(file, metadata);
+
+  if (!metadata->validTrailer)
+  {
+    Rcpp::warning("Invalid file trailer!");
+    metadata->treeAddresses = scanTreeAddresses(file, metadata, selectionEnd(selection));
+  }
+
+  std::vector<size_t> selectedTrees = selectTrees(selection, metadata->treeAddresses.size());
+
+  std::vector<size_t> treeLengths = getTreeLengths(file, metadata);
+
+  std::vector<phylo> parsedTrees(selectedTrees.size());
+
+  std::vector<std::string> treeNames(selectedTrees.size());
+
+  readBinaryTreesAt(file, isMapped, &selectedTrees, threads, metadata, &treeLengths, options, &parsedTrees);
+
+  for (size_t i = 0; i < parsedTrees.size(); i++)
+  {
+    treeNames[i] = getTreeName(&parsedTrees[i], selectedTrees[i]);
+  }
+
+  multiPhylo tbr;
+
+  tbr.trees = std::move(parsedTrees);
+  tbr.treeNames = std::move(treeNames);
+
+  return tbr;
+}
+
+//Convert the metadata of a tree file to an R object of class
+//"BinaryTreeMetadata". Tree addresses are returned as doubles, which can
+//represent exactly any address in files smaller than 8 PB.
+static Rcpp::List convertMetadata(BinaryTreeMetadata* metadata, bool includeAddresses)
+{
+  Rcpp::List tbr = Rcpp::List::create();
+
+  tbr.push_back(metadata->globalNames, "GlobalNames");
+  tbr.push_back(metadata->globalAttributes, "GlobalAttributes");
+
+  Rcpp::NumericVector treeAddresses(metadata->treeAddresses.size());
+
+  for (size_t i = 0; i < metadata->treeAddresses.size(); i++)
+  {
+    treeAddresses[i] = (double)metadata->treeAddresses[i];
+  }
+
+  if (includeAddresses && metadata->validTrailer)
+  {
+    tbr.push_back(treeAddresses, "TreeAddresses");
+  }
+
+  if (metadata->globalNames)
+  {
+    tbr.push_back(Rcpp::wrap(metadata->names), "Names");
+  }
+
+  if (metadata->globalAttributes)
+  {
+    Rcpp::CharacterVector attributeNames(metadata->attributes.size());
+    Rcpp::LogicalVector attributesAreNumeric(metadata->attributes.size());
+
+    for (size_t i = 0; i < metadata->attributes.size(); i++)
+    {
+      attributeNames[i] = metadata->attributes[i].AttributeName;
+      attributesAreNumeric[i] = metadata->attributes[i].IsNumeric;
+    }
+
+    tbr.push_back(Rcpp::List::create(Rcpp::Named("AttributeName") = attributeNames, Rcpp::Named("IsNumeric") = attributesAreNumeric), "Attributes");
+  }
+
+  if (includeAddresses && !metadata->validTrailer)
+  {
+    tbr.push_back(treeAddresses, "TreeAddresses");
+  }
+
+  tbr.attr("class") = "BinaryTreeMetadata";
+
+  return tbr;
+}
+
+//A file in binary tree format that is kept open (and memory-mapped) between
+//calls from R, together with its metadata. Used through an external pointer.
+struct BinaryTreeReader
+{
+  BinaryTreeReader(const std::string& fileName) : input(fileName) { }
+
+  BinaryInput input;
+  BinaryTreeMetadata metadata;
+
+  //Number of bytes occupied by each tree, computed when the file is opened.
+  std::vector<size_t> treeLengths;
+
+  //R strings for the global names, shared by all the trees read from the
+  //file. They are created as they are needed, and the vector holding them
+  //stays protected for as long as the reader exists.
+  std::unique_ptr<SharedNames> sharedNames;
+
+  //Index (0-based) of the next tree that will be returned by
+  //Rcpp_binary_tree_reader_next_chunk.
+  size_t nextTree = 0;
+};
+
+//Get the reader from an external pointer created by Rcpp_open_binary_tree_reader.
+static BinaryTreeReader* getReader(SEXP handle)
+{
+  Rcpp::XPtr<BinaryTreeReader> reader(handle);
+
+  if (reader.get() == NULL)
+  {
+    Rcpp::stop("The tree reader has already been closed!");
+  }
+
+  return reader.get();
+}
+
+//Convert a 1-based tree index into a 0-based index, checking that it is valid.
+static size_t getTreeIndex(BinaryTreeReader* reader, int index)
+{
+  if (index < 1 || (size_t)index > reader->metadata.treeAddresses.size())
+  {
+    Rcpp::stop("Invalid tree index: " + std::to_string(index) + "!");
+  }
+
+  return (size_t)(index - 1);
+}
+
+//Get the address of a tree given its (1-based) index.
+static int64_t getTreeAddress(BinaryTreeReader* reader, int index)
+{
+  return reader->metadata.treeAddresses[getTreeIndex(reader, index)];
+}
+
+//Read the trees with the specified (0-based) indices from a reader, using the
+//specified number of threads.
+static multiPhylo readTreesFromReader(BinaryTreeReader* reader, std::vector<size_t>* indices, int threads, const BinaryTreeReadOptions* options)
+{
+  BinaryCursor file = makeCursor(&reader->input);
+
+  multiPhylo trees;
+  trees.trees = std::vector<phylo>(indices->size());
+  trees.treeNames = std::vector<std::string>(indices->size());
+
+  readBinaryTreesAt(&file, reader->input.isMapped, indices, threads, &reader->metadata, &reader->treeLengths, options, &trees.trees);
+
+  for (size_t i = 0; i < indices->size(); i++)
+  {
+    trees.treeNames[i] = getTreeName(&trees.trees[i], (*indices)[i]);
+  }
+
+  return trees;
+}
+
+//Get a cursor over the contents of a file in binary tree format, which can be
+//provided from R either as a file name or as a raw vector. Files are opened
+//into *input, which must be kept alive while the cursor is in use; raw vectors
+//are read in place, without copying them.
+static BinaryCursor openSource(SEXP source, std::unique_ptr<BinaryInput>* input, size_t offset = 0)
+{
+  if (TYPEOF(source) == RAWSXP)
+  {
+    return makeCursor((const byte*)RAW(source), (size_t)XLENGTH(source), offset);
+  }
+  else if (TYPEOF(source) == STRSXP && XLENGTH(source) == 1)
+  {
+    input->reset(new BinaryInput(Rcpp::as<std::string>(source)));
+    return makeCursor(input->get(), offset);
+  }
+  else
+  {
+    Rcpp::stop("Expecting a file name or a raw vector!");
+  }
+}
+
+//Read a single tree in binary format from a file (or from a raw vector with
+//the contents of a file) and pass it back to R. If selectedAttributes is not
+//NULL, only the attributes it contains are decoded. If topologyOnly is true,
+//only the topology and the tip names are decoded.
+// [[Rcpp::export]]
+SEXP Rcpp_read_binary_tree(SEXP source, double offset, bool globalNames, std::vector<std::string> names, std::vector<std::string> attributeNames, std::vector<bool> attributesAreNumeric, SEXP selectedAttributes, bool topologyOnly)
+{
+ BinaryTreeMetadata metadata;
+
+ metadata.globalNames = globalNames;
+ metadata.names = names;
+ metadata.attributes = std::vector<Attribute>(attributeNames.size());
+
+ for (size_t i = 0; i < attributeNames.size(); i++)
+ {
+   metadata.attributes[i].AttributeName = attributeNames[i];
+   metadata.attributes[i].IsNumeric = attributesAreNumeric[i];
+ }
+
+ std::unique_ptr<BinaryInput> input;
+
+ BinaryCursor file = openSource(source, &input, (size_t)offset);
+
+ BinaryTreeReadOptions options = getReadOptions(selectedAttributes, topologyOnly);
+
+ phylo tree = readBinaryTree(&file, &metadata, &options);
+
+ SharedNames sharedNames(&metadata.names);
+
+ return Rcpp::wrap(convertPhylo(&tree, &sharedNames));
+}
+
+//Read multiple trees in binary format from a file (or from a raw vector with
+//the contents of a file) and pass them back to R. If threads is greater than
+//1, the trees are decoded in parallel; if it is 0 or negative, a thread is
+//used for each available core. If selectedAttributes is not NULL, only the
+//attributes it contains are decoded; if topologyOnly is true, only the
+//topology and the tip names are decoded. If indices is not NULL, only the
+//trees with the specified (1-based) indices are read; otherwise, the trees
+//from index from to index to (or to the last tree, if to is negative) are
+//read, taking one tree every by trees.
+// [[Rcpp::export]]
+SEXP Rcpp_read_binary_trees(SEXP source, int threads, SEXP selectedAttributes, bool topologyOnly, SEXP indices, int from, int to, int by)
+{
+  std::unique_ptr<BinaryInput> input;
+
+  BinaryCursor file = openSource(source, &input);
+
+  BinaryTreeReadOptions options = getReadOptions(selectedAttributes, topologyOnly);
+
+  BinaryTreeSelection selection;
+
+  if (!Rf_isNull(indices))
+  {
+    selection.useIndices = true;
+    selection.indices = Rcpp::as<std::vector<int>>(indices);
+  }
+
+  selection.from = from;
+  selection.to = to;
+  selection.by = by;
+
+  BinaryTreeMetadata metadata;
+
+  multiPhylo trees = readBinaryTrees(&file, &metadata, resolveThreads(threads), &options, &selection, input && input->isMapped);
+
+  SharedNames sharedNames(&metadata.names);
+
+  return Rcpp::wrap(convertMultiPhylo(&trees, &sharedNames));
+}
+
+//Read the metadata (header, global names and attributes, and tree addresses)
+//from a file in binary tree format (or from a raw vector with the contents of
+//a file) and pass it back to R. invalidTrailer
+//determines what happens if the file does not have a valid trailer: "scan"
+//reads the whole file to determine the tree addresses, "fail" stops with an
+//error, and "ignore" returns the metadata without the tree addresses.
+// [[Rcpp::export]]
+SEXP Rcpp_read_binary_tree_metadata(SEXP source, std::string invalidTrailer)
+{
+  std::unique_ptr<BinaryInput> input;
+
+  BinaryCursor file = openSource(source, &input);
+
+  BinaryTreeMetadata metadata;
+
+  readBinaryTreeMetadata(&file, &metadata);
+
+  bool includeAddresses = true;
+
+  if (!metadata.validTrailer)
+  {
+    if (invalidTrailer == "fail")
+    {
+      Rcpp::stop("Invalid file trailer!");
+    }
+
+    Rcpp::warning("Invalid file trailer!");
+
+    if (invalidTrailer == "ignore")
+    {
+      includeAddresses = false;
+    }
+    else
+    {
+      metadata.treeAddresses = scanTreeAddresses(&file, &metadata);
+    }
+  }
+
+  return Rcpp::wrap(convertMetadata(&metadata, includeAddresses));
+}
+
+//Repair a file in binary tree format that does not have a valid trailer
+//(e.g. because the program writing it was interrupted): the file is scanned
+//to determine the addresses of the complete trees, any incomplete data at
+//the end of the file is removed, and a new trailer is written. The metadata
+//of the repaired file is passed back to R.
+// [[Rcpp::export]]
+SEXP Rcpp_repair_binary_trees(std::string fileName)
+{
+  BinaryTreeMetadata metadata;
+  int64_t endAddress;
+
+  {
+    BinaryInput input(fileName);
+
+    BinaryCursor file = makeCursor(&input);
+
+    readBinaryTreeMetadata(&file, &metadata);
+
+    if (metadata.validTrailer)
+    {
+      Rcpp::warning("The file already has a valid trailer!");
+      return Rcpp::wrap(convertMetadata(&metadata, true));
+    }
+
+    metadata.treeAddresses = scanTreeAddresses(&file, &metadata);
+    endAddress = cursorPosition(&file);
+  }
+
+  //The input must have been closed (and unmapped) before the file is truncated.
+  if (!truncateFile(fileName, endAddress))
+  {
+    Rcpp::stop("ERROR! Could not truncate the file.");
+  }
+
+  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  std::vector<int64_t> addresses = metadata.treeAddresses;
+  addresses.push_back(endAddress);
+
+  BinaryOutput output(&file, endAddress);
+
+  finishWritingBinaryTrees(&output, &addresses, NULL, 0);
+
+  file.close();
+
+  metadata.validTrailer = true;
+
+  return Rcpp::wrap(convertMetadata(&metadata, true));
+}
+
+//Append trees provided by R to a file in binary tree format that has a valid
+//trailer, without rewriting the trees that are already in the file. The
+//trailer (and the global dictionary block, if any) is removed, and the new
+//trees are written after the existing ones, encoded using the global names
+//and attributes of the file. Then, the additional data of the file is copied
+//after the trees and a new trailer is written. Everything that is written is
+//encoded in memory first, so that the file is only modified (truncated and
+//then written with a single write) once encoding has succeeded. Returns the
+//number of trees in the file.
+// [[Rcpp::export]]
+int Rcpp_append_binary_trees(Rcpp::List trees, std::string fileName)
+{
+  multiPhylo convertedTrees = convertTrees(&trees);
+
+  BinaryTreeMetadata metadata;
+  int64_t endAddress;
+  std::vector<byte> additionalData;
+
+  {
+    BinaryInput input(fileName);
+
+    BinaryCursor file = makeCursor(&input);
+
+    readBinaryTreeMetadata(&file, &metadata);
+
+    if (!metadata.validTrailer)
+    {
+      Rcpp::stop("Invalid file trailer! The file should be repaired before appending trees to it.");
+    }
+
+    //The trees end after the last tree in the file or, if there are no
+    //trees, after the header.
+    if (!metadata.treeAddresses.empty())
+    {
+      seekCursor(&file, *std::max_element(metadata.treeAddresses.begin(), metadata.treeAddresses.end()));
+      skipBinaryTree(&file, &metadata);
+    }
+
+    endAddress = cursorPosition(&file);
+
+    //The additional data is between the trees (or the global dictionary
+    //block) and the trailer.
+    if (metadata.deferredGlobals)
+    {
+      seekCursor(&file, metadata.dictionaryAddress);
+      skipGlobals(&file, &metadata);
+    }
+
+    if ((int64_t)cursorPosition(&file) > metadata.trailerAddress)
+    {
+      Rcpp::stop("Invalid file trailer!");
+    }
+
+    additionalData.assign(file.current, file.start + metadata.trailerAddress);
+  }
+
+  BinaryOutput output(NULL, endAddress);
+
+  appendBinaryTrees(&convertedTrees, &output, &metadata, additionalData.data(), additionalData.size());
+
+  //The input must have been closed (and unmapped) before the file is truncated.
+  if (!truncateFile(fileName, endAddress))
+  {
+    Rcpp::stop("ERROR! Could not truncate the file.");
+  }
+
+  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  file.write((const char*)output.buffer.data(), output.buffer.size());
+  file.close();
+
+  if (file.fail())
+  {
+    Rcpp::stop("ERROR! Could not write to the file.");
+  }
+
+  return (int)(metadata.treeAddresses.size() + convertedTrees.trees.size());
+}
+
+//Copy a single tree in binary format from the input to the output, replacing
+//the references to the global names and attributes of the input with
+//references to those of the output. nameMap and attributeMap contain the
+//(0-based) index in the output of each global name and attribute of the
+//input. If outputGlobalNames is true but the input does not have global
+//names, the names are written in full (with the escape used for names that
+//are not among the global names). Everything else (including the topology
+//and any local list of attributes) is copied without decoding it.
+static void transcodeBinaryTree(BinaryCursor* file, const BinaryTreeMetadata* metadata, BinaryOutput* output, bool outputGlobalNames, const std::vector<int32_t>* nameMap, const std::vector<int32_t>* attributeMap)
+{
+  const byte* start = file->current;
+
+  int32_t numAttributes = readInt(file);
+
+  std::vector<Attribute> treeAttributes;
+  const std::vector<Attribute>* attributes = &metadata->attributes;
+
+  if (numAttributes > 0)
+  {
+    treeAttributes = std::vector<Attribute>(numAttributes);
+
+    for (int i = 0; i < numAttributes; i++)
+    {
+      treeAttributes[i].AttributeName = readMyString(file);
+      treeAttributes[i].IsNumeric = readInt(file) == 2;
+    }
+
+    attributes = &treeAttributes;
+  }
+
+  std::vector<bool> isName(attributes->size());
+
+  for (size_t i = 0; i < attributes->size(); i++)
+  {
+    isName[i] = !(*attributes)[i].IsNumeric && equalCI((*attributes)[i].AttributeName, NAMEATTRIBUTE);
+  }
+
+  int64_t nodeCount = 0;
+  int64_t expectedNodes = 1;
+
+  ShortIntReader shortInts;
+
+  while (nodeCount < expectedNodes)
+  {
+    int32_t currCount = readShortInt(file, &shortInts);
+
+    if (currCount < 0)
+    {
+      throw std::out_of_range("Invalid number of children!");
+    }
+
+    expectedNodes += currCount;
+    nodeCount++;
+  }
+
+  //The list of attributes and the topology are copied as they are.
+  writeBytes(output, start, file->current - start);
+
+  for (int64_t i = 0; i < nodeCount; i++)
+  {
+    int32_t attributeCount = readInt(file);
+    writeInt(output, attributeCount);
+
+    for (int j = 0; j < attributeCount; j++)
+    {
+      int32_t attributeIndex = readInt(file);
+
+      if (attributeIndex < 0 || (size_t)attributeIndex >= attributes->size())
+      {
+        throw std::out_of_range("Invalid attribute index!");
+      }
+
+      writeInt(output, numAttributes > 0 ? attributeIndex : (*attributeMap)[attributeIndex]);
+
+      const byte* value = file->current;
+
+      if ((*attributes)[attributeIndex].IsNumeric)
+      {
+        readBytes(file, 8);
+      }
+      else if (isName[attributeIndex] && metadata->globalNames)
+      {
+        byte b = readByte(file);
+
+        if (b != 0 && b != 255)
+        {
+          file->current--;
+          int32_t index = readInt(file);
+
+          if (index < 1 || (size_t)index > metadata->names.size())
+          {
+            throw std::out_of_range("Invalid name index!");
+          }
+
+          writeInt(output, (*nameMap)[index - 1] + 1);
+          continue;
+        }
+        else if (b == 255)
+        {
+          skipMyString(file);
+        }
+      }
+      else
+      {
+        if (isName[attributeIndex] && outputGlobalNames)
+        {
+          writeByte(output, 255);
+        }
+
+        skipMyString(file);
+      }
+
+      writeBytes(output, value, file->current - value);
+    }
+  }
+}
+
+//Merge multiple files in binary tree format into a single file, which will
+//contain the trees of the first file, followed by those of the second file,
+//and so on. The global names and attributes of the output are the union of
+//those of the input files. The trees from input files whose global names and
+//attributes have the same index in the output (which is always the case for
+//the first file, and for files without global names and attributes, when none
+//of the files have them) are copied in bulk, and their addresses are
+//relocated. The other trees are copied one at a time, replacing the indices of
+//the global names and attributes; the trees are never decoded. Returns the
+//number of trees in the output file.
+// [[Rcpp::export]]
+int Rcpp_merge_binary_trees(std::vector<std::string> inputFiles, std::string outputFile, std::vector<Rbyte> additionalData)
+{
+  std::vector<std::unique_ptr<BinaryInput>> inputs(inputFiles.size());
+  std::vector<BinaryTreeMetadata> metadata(inputFiles.size());
+
+  bool globalNames = false;
+  bool globalAttributes = false;
+
+  for (size_t k = 0; k < inputFiles.size(); k++)
+  {
+    inputs[k] = std::unique_ptr<BinaryInput>(new BinaryInput(inputFiles[k]));
+
+    BinaryCursor file = makeCursor(inputs[k].get());
+
+    readBinaryTreeMetadata(&file, &metadata[k]);
+
+    if (!metadata[k].validTrailer)
+    {
+      Rcpp::warning("Invalid file trailer in " + inputFiles[k] + "!");
+      metadata[k].treeAddresses = scanTreeAddresses(&file, &metadata[k]);
+    }
+
+    globalNames = globalNames || metadata[k].globalNames;
+    globalAttributes = globalAttributes || metadata[k].globalAttributes;
+  }
+
+  //Determine the global names and attributes of the output, and where each
+  //global name and attribute of each input ends up.
+  std::unordered_map<std::string_view, int32_t> namesLookup;
+  std::vector<std::string_view> allNames;
+  std::vector<Attribute> allAttributes;
+
+  std::vector<std::vector<int32_t>> nameMaps(inputFiles.size());
+  std::vector<std::vector<int32_t>> attributeMaps(inputFiles.size());
+  std::vector<bool> sameIndices(inputFiles.size());
+
+  for (size_t k = 0; k < inputFiles.size(); k++)
+  {
+    sameIndices[k] = metadata[k].globalNames == globalNames;
+
+    for (size_t i = 0; i < metadata[k].names.size(); i++)
+    {
+      std::pair<std::unordered_map<std::string_view, int32_t>::iterator, bool> inserted = namesLookup.try_emplace(metadata[k].names[i], (int32_t)allNames.size());
+
+      if (inserted.second)
+      {
+        allNames.push_back(metadata[k].names[i]);
+      }
+
+      nameMaps[k].push_back(inserted.first->second);
+      sameIndices[k] = sameIndices[k] && inserted.first->second == (int32_t)i;
+    }
+
+    for (size_t i = 0; i < metadata[k].attributes.size(); i++)
+    {
+      int index = attributeIndex(&allAttributes, &metadata[k].attributes[i]);
+
+      if (index < 0)
+      {
+        index = (int)allAttributes.size();
+        allAttributes.push_back(metadata[k].attributes[i]);
+      }
+
+      attributeMaps[k].push_back(index);
+      sameIndices[k] = sameIndices[k] && index == (int)i;
+    }
+  }
+
+  std::fstream file(outputFile, std::fstream::binary | std::fstream::out);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  BinaryOutput output(&file);
+
+  byte header[4] = { 0x23, 0x54, 0x52, 0x45 };
+  writeBytes(&output, header, 4);
+  writeByte(&output, (globalNames ? 0b00000001 : 0) | (globalAttributes ? 0b00000010 : 0));
+
+  if (globalNames)
+  {
+    writeGlobalNames(&output, &allNames);
+  }
+
+  if (globalAttributes)
+  {
+    writeGlobalAttributes(&output, &allAttributes);
+  }
+
+  std::vector<int64_t> addresses;
+
+  for (size_t k = 0; k < inputFiles.size(); k++)
+  {
+    std::vector<int64_t>* treeAddresses = &metadata[k].treeAddresses;
+
+    if (treeAddresses->empty())
+    {
+      continue;
+    }
+
+    BinaryCursor input = makeCursor(inputs[k].get());
+
+    if (sameIndices[k] && std::is_sorted(treeAddresses->begin(), treeAddresses->end()))
+    {
+      //The trees are copied as a single block, from the start of the first
+      //tree to the end of the last tree.
+      seekCursor(&input, treeAddresses->back());
+      skipBinaryTree(&input, &metadata[k]);
+
+      int64_t start = (*treeAddresses)[0];
+      int64_t offset = outputPosition(&output) - start;
+
+      for (size_t i = 0; i < treeAddresses->size(); i++)
+      {
+        addresses.push_back((*treeAddresses)[i] + offset);
+      }
+
+      copyBytes(&output, input.start + start, cursorPosition(&input) - start);
+    }
+    else
+    {
+      for (size_t i = 0; i < treeAddresses->size(); i++)
+      {
+        seekCursor(&input, (*treeAddresses)[i]);
+        addresses.push_back(outputPosition(&output));
+        transcodeBinaryTree(&input, &metadata[k], &output, globalNames, &nameMaps[k], &attributeMaps[k]);
+        flushOutputIfFull(&output);
+      }
+    }
+  }
+
+  addresses.push_back(outputPosition(&output));
+
+  finishWritingBinaryTrees(&output, &addresses, additionalData.data(), additionalData.size());
+
+  file.close();
+
+  return (int)addresses.size() - 1;
+}
+
+//Copy some of the trees from a file in binary tree format into a new file,
+//without decoding them. The header (including the global names and
+//attributes), the global dictionary block (if any) and the additional data
+//are copied as they are; each selected tree is copied as a range of bytes,
+//which extends until the start of the next tree in the file (only the last
+//tree in the file needs to be skipped to find where it ends). Consecutive trees
+//are copied together. The trees are selected as in Rcpp_read_binary_trees.
+//Returns the number of trees in the new file.
+// [[Rcpp::export]]
+int Rcpp_subset_binary_trees(std::string inputFile, std::string outputFile, SEXP indices, int from, int to, int by)
+{
+  BinaryInput input(inputFile);
+
+  BinaryCursor file = makeCursor(&input);
+
+  BinaryTreeMetadata metadata;
+
+  readBinaryTreeMetadata(&file, &metadata);
+
+  int64_t headerEnd = cursorPosition(&file);
+
+  if (!metadata.validTrailer)
+  {
+    Rcpp::warning("Invalid file trailer!");
+    metadata.treeAddresses = scanTreeAddresses(&file, &metadata);
+  }
+
+  BinaryTreeSelection selection;
+
+  if (!Rf_isNull(indices))
+  {
+    selection.useIndices = true;
+    selection.indices = Rcpp::as<std::vector<int>>(indices);
+  }
+
+  selection.from = from;
+  selection.to = to;
+  selection.by = by;
+
+  std::vector<size_t> selectedTrees = selectTrees(&selection, metadata.treeAddresses.size());
+
+  std::vector<int64_t> sortedAddresses = metadata.treeAddresses;
+  std::sort(sortedAddresses.begin(), sortedAddresses.end());
+
+  //Find the end of the last tree in the file, which is also where the
+  //additional data starts (unless the file has a global dictionary block).
+  int64_t treesEnd = headerEnd;
+
+  if (!sortedAddresses.empty())
+  {
+    seekCursor(&file, sortedAddresses.back());
+    skipBinaryTree(&file, &metadata);
+    treesEnd = cursorPosition(&file);
+  }
+
+  int64_t dictionaryEnd = -1;
+  int64_t additionalDataStart = treesEnd;
+  int64_t additionalDataEnd = treesEnd;
+
+  if (metadata.deferredGlobals)
+  {
+    seekCursor(&file, metadata.dictionaryAddress);
+    skipGlobals(&file, &metadata);
+    dictionaryEnd = cursorPosition(&file);
+    additionalDataStart = dictionaryEnd;
+  }
+
+  if (metadata.validTrailer)
+  {
+    additionalDataEnd = metadata.trailerAddress;
+  }
+
+  if (additionalDataStart > additionalDataEnd)
+  {
+    Rcpp::stop("Invalid file trailer!");
+  }
+
+  std::fstream outputStream(outputFile, std::fstream::binary | std::fstream::out);
+
+  if (!outputStream.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  BinaryOutput output(&outputStream);
+
+  copyBytes(&output, input.data, headerEnd);
+
+  std::vector<int64_t> addresses;
+
+  //Range of bytes in the input that has not been copied yet.
+  int64_t rangeStart = 0;
+  int64_t rangeEnd = 0;
+
+  for (size_t i = 0; i < selectedTrees.size(); i++)
+  {
+    int64_t address = metadata.treeAddresses[selectedTrees[i]];
+    std::vector<int64_t>::iterator next = std::upper_bound(sortedAddresses.begin(), sortedAddresses.end(), address);
+    int64_t end = next != sortedAddresses.end() ? *next : treesEnd;
+
+    if (address != rangeEnd)
+    {
+      copyBytes(&output, input.data + rangeStart, rangeEnd - rangeStart);
+      flushOutputIfFull(&output);
+      rangeStart = address;
+    }
+
+    addresses.push_back(outputPosition(&output) + address - rangeStart);
+    rangeEnd = end;
+  }
+
+  copyBytes(&output, input.data + rangeStart, rangeEnd - rangeStart);
+
+  int64_t dictionaryAddress = -1;
+
+  if (metadata.deferredGlobals)
+  {
+    dictionaryAddress = outputPosition(&output);
+    copyBytes(&output, input.data + metadata.dictionaryAddress, dictionaryEnd - metadata.dictionaryAddress);
+  }
+
+  addresses.push_back(outputPosition(&output));
+
+  finishWritingBinaryTrees(&output, &addresses, input.data + additionalDataStart, additionalDataEnd - additionalDataStart, dictionaryAddress);
+
+  outputStream.close();
+
+  return (int)addresses.size() - 1;
+}
+
+//Open a file in binary tree format and read its metadata, returning an
+//external pointer to a reader that keeps the file open. If the file does not
+//have a valid trailer, it is scanned to determine the addresses of the trees.
+// [[Rcpp::export]]
+SEXP Rcpp_open_binary_tree_reader(std::string fileName)
+{
+  Rcpp::XPtr<BinaryTreeReader> reader(new BinaryTreeReader(fileName), true);
+
+  BinaryCursor file = makeCursor(&reader->input);
+
+  readBinaryTreeMetadata(&file, &reader->metadata);
+
+  if (!reader->metadata.validTrailer)
+  {
+    Rcpp::warning("Invalid file trailer!");
+    reader->metadata.treeAddresses = scanTreeAddresses(&file, &reader->metadata);
+  }
+
+  reader->treeLengths = getTreeLengths(&file, &reader->metadata);
+
+  reader->sharedNames = std::make_unique<SharedNames>(&reader->metadata.names);
+
+  return reader;
+}
+
+//Get the number of trees in a file opened with Rcpp_open_binary_tree_reader.
+// [[Rcpp::export]]
+int Rcpp_binary_tree_reader_length(SEXP handle)
+{
+  return (int)getReader(handle)->metadata.treeAddresses.size();
+}
+
+//Read a single tree (given its 1-based index) from a file opened with
+//Rcpp_open_binary_tree_reader and pass it back to R. If selectedAttributes
+//is not NULL, only the attributes it contains are decoded. If topologyOnly is
+//true, only the topology and the tip names are decoded.
+// [[Rcpp::export]]
+SEXP Rcpp_get_tree(SEXP handle, int index, SEXP selectedAttributes, bool topologyOnly)
+{
+  BinaryTreeReader* reader = getReader(handle);
+
+  BinaryCursor file = makeCursor(&reader->input, getTreeAddress(reader, index));
+
+  BinaryTreeReadOptions options = getReadOptions(selectedAttributes, topologyOnly);
+
+  phylo tree = readBinaryTree(&file, &reader->metadata, &options);
+
+  return Rcpp::wrap(convertPhylo(&tree, reader->sharedNames.get()));
+}
+
+//Read multiple trees (given their 1-based indices) from a file opened with
+//Rcpp_open_binary_tree_reader and pass them back to R. If threads is greater
+//than 1, the trees are decoded in parallel. If selectedAttributes is not NULL,
+//only the attributes it contains are decoded. If topologyOnly is true, only
+//the topology and the tip names are decoded.
+// [[Rcpp::export]]
+SEXP Rcpp_get_trees(SEXP handle, std::vector<int> indices, int threads, SEXP selectedAttributes, bool topologyOnly)
+{
+  BinaryTreeReader* reader = getReader(handle);
+
+  std::vector<size_t> treeIndices(indices.size());
+
+  for (size_t i = 0; i < indices.size(); i++)
+  {
+    treeIndices[i] = getTreeIndex(reader, indices[i]);
+  }
+
+  BinaryTreeReadOptions options = getReadOptions(selectedAttributes, topologyOnly);
+
+  multiPhylo trees = readTreesFromReader(reader, &treeIndices, resolveThreads(threads), &options);
+
+  return Rcpp::wrap(convertMultiPhylo(&trees, reader->sharedNames.get()));
+}
+
+//Read the next chunk of (at most) chunkSize trees from a file opened with
+//Rcpp_open_binary_tree_reader and pass them back to R, or return NULL if all
+//the trees have already been read. Only the trees in the chunk are decoded,
+//so that a file can be processed a chunk at a time regardless of its size.
+//If threads is greater than 1, the trees are decoded in parallel. If
+//selectedAttributes is not NULL, only the attributes it contains are decoded.
+//If topologyOnly is true, only the topology and the tip names are decoded.
+// [[Rcpp::export]]
+SEXP Rcpp_binary_tree_reader_next_chunk(SEXP handle, int chunkSize, int threads, SEXP selectedAttributes, bool topologyOnly)
+{
+  BinaryTreeReader* reader = getReader(handle);
+
+  if (chunkSize < 1)
+  {
+    Rcpp::stop("The chunk size must be at least 1!");
+  }
+
+  size_t treeCount = reader->metadata.treeAddresses.size();
+
+  if (reader->nextTree >= treeCount)
+  {
+    return R_NilValue;
+  }
+
+  std::vector<size_t> treeIndices(std::min((size_t)chunkSize, treeCount - reader->nextTree));
+
+  for (size_t i = 0; i < treeIndices.size(); i++)
+  {
+    treeIndices[i] = reader->nextTree + i;
+  }
+
+  BinaryTreeReadOptions options = getReadOptions(selectedAttributes, topologyOnly);
+
+  multiPhylo trees = readTreesFromReader(reader, &treeIndices, resolveThreads(threads), &options);
+
+  //The position only moves forward once the chunk has been read successfully.
+  reader->nextTree += treeIndices.size();
+
+  return Rcpp::wrap(convertMultiPhylo(&trees, reader->sharedNames.get()));
+}
+
+//Close a file opened with Rcpp_open_binary_tree_reader. This happens
+//automatically when the external pointer is garbage-collected, but closing
+//the reader explicitly releases the file immediately.
+// [[Rcpp::export]]
+void Rcpp_close_binary_tree_reader(SEXP handle)
+{
+  Rcpp::XPtr<BinaryTreeReader> reader(handle);
+  reader.release();
+}
@@ -10,6 +10,7 @@
 // [[Rcpp::plugins(cpp17)]]
 
 #include "common.h"
+#include <string_view>
 
 using namespace Rcpp;
 
@@ -89,16 +90,16 @@ static bool tryParse(std::string val, int* output = NULL)
 //Read the next non-whitespace token from a string, taking into account quotes and escape characters.
 //The current position is determined by *srPosition, which should be initialised to 0. The bool
 //arguments should all be initialised to false.
-char nextToken(std::string* source, int* srPosition, bool* escaping, bool* escaped, bool* openQuotes, bool* openApostrophe, bool* eof)
+char nextToken(std::string_view source, size_t* srPosition, bool* escaping, bool* escaped, bool* openQuotes, bool* openApostrophe, bool* eof)
 {
-  if ((size_t)(*srPosition) >= source->length())
+  if (*srPosition >= source.length())
   {
     (*eof) = true;
     (*escaped) = false;
     return -1;
   }
 
-  char c = source->at(*srPosition);
+  char c = source[*srPosition];
   (*srPosition)++;
 
   (*eof) = false;
@@ -110,14 +111,14 @@ char nextToken(std::string* source, int* srPosition, bool* escaping, bool* escap
     {
       while (std::isspace(c))
       {
-        if ((size_t)(*srPosition) >= source->length())
+        if (*srPosition >= source.length())
         {
           (*eof) = true;
           (*escaped) = false;
           return -1;
         }
 
-        c = source->at(*srPosition);
+        c = source[*srPosition];
         (*srPosition)++;
       }
 
@@ -308,7 +309,7 @@ bool containsKey(std::map<std::string, std::variant<std::string, double>, ci_les
 }
 
 //Parse the attributes of a NWKA node into the *attributes map.
-static void parseAttributes(std::string* sr, int* srPosition, bool* eof, std::map<std::string, std::variant<std::string, double>, ci_less>* attributes, int childCount)
+static void parseAttributes(std::string_view sr, size_t* srPosition, bool* eof, std::map<std::string, std::variant<std::string, double>, ci_less>* attributes, int childCount)
 {
   std::stringstream attributeValue;
   std::stringstream attributeName;
@@ -664,203 +665,203 @@ static void parseAttributes(std::string* sr, int* srPosition, bool* eof, std::ma
   }
 }
 
-//Parse a NWKA-format string into a series of vectors containing parent-child relationships between the nodes
-//and node attributes. This will trim the source string in place and remove a trailing semicolon.
-static int parseNWKA(std::string* source, int* currIndex, std::vector<int>* allParents, std::vector<std::vector<int>>* allChildren, std::vector<std::map<std::string, std::variant<std::string, double>, ci_less>>* allAttributes, int* tipCount, int parent = -1, bool debug = false)
+//Remove whitespace from both ends of the text of a node, as well as a trailing semicolon.
+static std::string_view trimNode(std::string_view source)
 {
-  trim(*source);
-
-  if (source->find(";", source->length() - 1) == source->length() - 1)
+  while (!source.empty() && std::isspace(source.front()))
   {
-    source->erase(source->end() - 1, source->end());
+    source.remove_prefix(1);
   }
 
-  if (debug)
+  while (!source.empty() && std::isspace(source.back()))
   {
-    Rcpp::Rcout << "Parsing: " << *source;
+    source.remove_suffix(1);
   }
 
-  if (source->rfind("(", 0) == 0)
+  if (!source.empty() && source.back() == ';')
   {
-    std::stringstream childrenBuilder;
+    source.remove_suffix(1);
+  }
 
-    int srPosition = 1;
+  return source;
+}
 
-    bool closed = false;
-    int openCount = 0;
-    int openSquareCount = 0;
-    int openCurlyCount = 0;
+//Parse the attributes of a node from the text that follows its children (or from the whole text of a
+//tip).
+static void parseNodeAttributes(std::string_view source, int node, std::vector<std::vector<int>>* allChildren, std::vector<std::map<std::string, std::variant<std::string, double>, ci_less>>* allAttributes, bool debug)
+{
+  size_t srPosition = 0;
+  bool eof = false;
 
-    bool escaping = false;
-    bool escaped;
-    bool openQuotes = false;
-    bool openApostrophe = false;
-    bool eof = false;
+  parseAttributes(source, &srPosition, &eof, &((*allAttributes)[node]), (*allChildren)[node].size());
 
-    std::vector<int> commas;
-    int position = 0;
+  if (debug)
+  {
+    Rcpp::Rcout << "\nAttributes (node " << node << "):\n";
 
-    while (!closed && !eof)
-    {
-      char c = nextToken(source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
+    std::map<std::string, std::variant<std::string, double>, ci_less>::iterator it;
 
-      if (!escaped)
+    for (it = (*allAttributes)[node].begin(); it != (*allAttributes)[node].end(); it++)
+    {
+      if (it->second.index() == 0)
       {
-        if (!openQuotes && !openApostrophe)
-        {
-          switch (c)
-          {
-          case '(':
-            openCount++;
-            break;
-          case ')':
-            if (openCount > 0)
-            {
-              openCount--;
-            }
-            else
-            {
-              closed = true;
-            }
-            break;
-          case '[':
-            openSquareCount++;
-            break;
-          case ']':
-            openSquareCount--;
-            break;
-          case '{':
-            openCurlyCount++;
-            break;
-          case '}':
-            openCurlyCount--;
-            break;
-          case ',':
-            if (openCount == 0 && openSquareCount == 0 && openCurlyCount == 0)
-            {
-              commas.push_back(position);
-            }
-            break;
-          }
-        }
+        Rcpp::Rcout << " - " << it->first << " = " << std::get<std::string>(it->second) << "\n";
       }
-
-      if (!closed && !eof)
+      else
       {
-        childrenBuilder << c;
-        position++;
+        Rcpp::Rcout << " - " << it->first << " = " << std::to_string(std::get<double>(it->second)) << "\n";
       }
     }
 
-    std::vector<std::string> children;
+    Rcpp::Rcout << "\n";
+  }
+}
 
-    if (commas.size() > 0)
-    {
-      std::string childrenString = childrenBuilder.str();
+//An internal node whose closing bracket has not been reached yet while parsing a NWKA string, with the
+//number of open brackets of each kind right after its opening bracket.
+struct OpenNWKANode
+{
+  int index;
+  int openCount;
+  int openSquareCount;
+  int openCurlyCount;
+};
 
-      for (size_t i = 0; i < commas.size(); i++)
-      {
-        children.push_back(childrenString.substr(i > 0 ? commas[i - 1] + 1 : 0, commas[i] - (i > 0 ? commas[i - 1] + 1 : 0)));
-      }
-      children.push_back(childrenString.substr(commas.back() + 1, childrenString.length() - commas.back() - 1));
-    }
-    else
-    {
-      children.push_back(childrenBuilder.str());
-    }
+//Parse a NWKA-format string into a series of vectors containing parent-child relationships between the nodes
+//and node attributes. The string is scanned only once, keeping the internal nodes that have not been closed
+//yet on an explicit stack; nodes are numbered in depth-first order as they are opened, and the attributes of
+//each node are parsed (in place) as soon as the end of the node is reached. Whitespace and a trailing
+//semicolon are ignored at the ends of the string and of each node.
+static void parseNWKA(std::string_view source, std::vector<int>* allParents, std::vector<std::vector<int>>* allChildren, std::vector<std::map<std::string, std::variant<std::string, double>, ci_less>>* allAttributes, int* tipCount, bool debug = false)
+{
+  source = trimNode(source);
 
-    if (debug)
-    {
-      Rcpp::Rcout << "\n";
-      Rcpp::Rcout << "Children:\n";
-      for (size_t i = 0; i < children.size(); i++)
-      {
-        Rcpp::Rcout << " - " + children[i] << "\n";
-      }
-      Rcpp::Rcout << "\n";
-    }
+  if (debug)
+  {
+    Rcpp::Rcout << "Parsing: " << source << "\n";
+  }
 
-    int myIndex = *currIndex;
-    (*currIndex)++;
+  std::vector<OpenNWKANode> openNodes;
 
-    allParents->push_back(parent);
-    allChildren->push_back(std::vector<int>());
+  size_t srPosition = 0;
 
-    allAttributes->push_back(std::map<std::string, std::variant<std::string, double>, ci_less>());
+  bool escaping = false;
+  bool escaped;
+  bool openQuotes = false;
+  bool openApostrophe = false;
+  bool eof = false;
 
-    parseAttributes(source, &srPosition, &eof, &((*allAttributes)[myIndex]), children.size());
+  int openCount = 0;
+  int openSquareCount = 0;
+  int openCurlyCount = 0;
 
-    if (debug)
-    {
-      Rcpp::Rcout << "\nAttributes:\n";
+  //The node whose attributes are being scanned and the position at which they start.
+  int currNode = -1;
+  size_t attributesStart = 0;
 
-      std::map<std::string, std::variant<std::string, double>>::iterator it;
+  //Whether the next token is the first token of a new node.
+  bool nodeStart = true;
 
-      for (it = (*allAttributes)[myIndex].begin(); it != (*allAttributes)[myIndex].end(); it++)
-      {
-        if (it->second.index() == 0)
-        {
-          Rcpp::Rcout << " - " << it->first << " = " << std::get<std::string>(it->second) << "\n";
-        }
-        else
-        {
-          Rcpp::Rcout << " - " << it->first << " = " << std::to_string(std::get<double>(it->second)) << "\n";
-        }
+  while (!eof && (nodeStart || !openNodes.empty()))
+  {
+    size_t tokenStart = srPosition;
 
-      }
+    char c = nextToken(source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
 
-      Rcpp::Rcout << "\n";
-    }
+    bool unquoted = !eof && !escaped && !openQuotes && !openApostrophe;
 
-    for (size_t i = 0; i < children.size(); i++)
+    if (nodeStart)
     {
-      int childInd = parseNWKA(&(children[i]), currIndex, allParents, allChildren, allAttributes, tipCount, myIndex, debug);
-      (*allChildren)[myIndex].push_back(childInd);
-    }
-
-    return myIndex;
-  }
-  else
-  {
-    int srPosition = 0;
+      nodeStart = false;
 
-    bool eof = false;
+      int parent = openNodes.empty() ? -1 : openNodes.back().index;
 
-    int myIndex = *currIndex;
-    (*currIndex)++;
+      currNode = allParents->size();
 
-    (*tipCount)++;
+      allParents->push_back(parent);
+      allChildren->push_back(std::vector<int>());
+      allAttributes->push_back(std::map<std::string, std::variant<std::string, double>, ci_less>());
 
-    allParents->push_back(parent);
-    allChildren->push_back(std::vector<int>());
+      if (parent >= 0)
+      {
+        (*allChildren)[parent].push_back(currNode);
+      }
 
-    allAttributes->push_back(std::map<std::string, std::variant<std::string, double>, ci_less>());
-    parseAttributes(source, &srPosition, &eof, &((*allAttributes)[myIndex]), 0);
+      if (unquoted && c == '(')
+      {
+        openCount++;
+        openNodes.push_back({ currNode, openCount, openSquareCount, openCurlyCount });
+        nodeStart = true;
+        continue;
+      }
 
-    if (debug)
-    {
-      Rcpp::Rcout << "\nAttributes:\n";
+      (*tipCount)++;
+      attributesStart = tokenStart;
 
-      std::map<std::string, std::variant<std::string, double>>::iterator it;
+      //If the root node is a tip, the whole string contains its attributes.
+      if (openNodes.empty())
+      {
+        break;
+      }
+    }
 
-      for (it = (*allAttributes)[myIndex].begin(); it != (*allAttributes)[myIndex].end(); it++)
+    if (unquoted)
+    {
+      switch (c)
       {
-        if (it->second.index() == 0)
+      case '(':
+        openCount++;
+        break;
+      case ')':
+        if (openCount > openNodes.back().openCount)
         {
-          Rcpp::Rcout << " - " << it->first << " = " << std::get<std::string>(it->second) << "\n";
+          openCount--;
         }
         else
         {
-          Rcpp::Rcout << " - " << it->first << " = " << std::to_string(std::get<double>(it->second)) << "\n";
-        }
+          //This closes the innermost open node, whose attributes start after the bracket.
+          parseNodeAttributes(trimNode(source.substr(attributesStart, srPosition - 1 - attributesStart)), currNode, allChildren, allAttributes, debug);
 
+          openCount--;
+          currNode = openNodes.back().index;
+          attributesStart = srPosition;
+          openNodes.pop_back();
+        }
+        break;
+      case '[':
+        openSquareCount++;
+        break;
+      case ']':
+        openSquareCount--;
+        break;
+      case '{':
+        openCurlyCount++;
+        break;
+      case '}':
+        openCurlyCount--;
+        break;
+      case ',':
+        if (openCount == openNodes.back().openCount && openSquareCount == openNodes.back().openSquareCount && openCurlyCount == openNodes.back().openCurlyCount)
+        {
+          parseNodeAttributes(trimNode(source.substr(attributesStart, srPosition - 1 - attributesStart)), currNode, allChildren, allAttributes, debug);
+          nodeStart = true;
+        }
+        break;
       }
-
-      Rcpp::Rcout << "\n";
     }
+  }
+
+  //The rest of the string contains the attributes of the root node (if it has been closed), or of the last
+  //node that was opened (if the string ended before some nodes were closed, in which case the nodes that are
+  //still open do not have any attributes). The text of the root node has already been trimmed.
+  std::string_view attributes = source.substr(attributesStart);
 
-    return myIndex;
+  if (currNode != 0)
+  {
+    attributes = trimNode(attributes);
   }
+
+  parseNodeAttributes(attributes, currNode, allChildren, allAttributes, debug);
 }
 
 //Create a phylo object from parent-child relationships between nodes and attributes.
@@ -878,7 +879,7 @@ static phylo convertToPhylo(std::vector<int>* allParents, std::vector<std::vecto
   }
 
   tbr.edgeLength = std::vector<double>(allParents->size() - 1);
-  tbr.edge = std::vector<std::vector<int32_t>>(allParents->size() - 1);
+  tbr.edge = std::vector<std::array<int32_t, 2>>(allParents->size() - 1);
   tbr.tipLabel = std::vector<std::string>(tipCount);
   tbr.nodeLabel = std::vector<std::string>(nodeCount);
 
@@ -896,7 +897,7 @@ static phylo convertToPhylo(std::vector<int>* allParents, std::vector<std::vecto
 
       if ((*allParents)[i] >= 0)
       {
-        std::vector<int32_t> edge(2);
+        std::array<int32_t, 2> edge;
         edge[0] = nodeCorresp[(*allParents)[i]] - 1;
         edge[1] = nonTipIndex + tipCount - 1;
 
@@ -969,7 +970,7 @@ static phylo convertToPhylo(std::vector<int>* allParents, std::vector<std::vecto
 
       if ((*allParents)[i] >= 0)
       {
-        std::vector<int32_t> edge(2);
+        std::array<int32_t, 2> edge;
         edge[0] = nodeCorresp[(*allParents)[i]] - 1;
         edge[1] = tipIndex - 1;
 
@@ -1103,12 +1104,13 @@ static phylo convertToPhylo(std::vector<int>* allParents, std::vector<std::vecto
 //Parse a NWKA string containing a single tree into a phylo object.
 static phylo parseNWKAStringOneTree(std::string* source, bool debug)
 {
-  int currIndex = 0;
   std::vector<int> allParents;
   std::vector < std::vector<int>> allChildren;
   std::vector<std::map<std::string, std::variant<std::string, double>, ci_less>> allAttributes;
   int tipCount = 0;
 
+  std::string_view treeString = *source;
+
   std::string::size_type index = source->find("(", 0);
 
   std::string treeName = "";
@@ -1116,10 +1118,10 @@ static phylo parseNWKAStringOneTree(std::string* source, bool debug)
   if (index != std::string::npos)
   {
     treeName = source->substr(0, index);
-    *source = source->substr(index);
+    treeString.remove_prefix(index);
   }
 
-  parseNWKA(source, &currIndex, &allParents, &allChildren, &allAttributes, &tipCount, -1, debug);
+  parseNWKA(treeString, &allParents, &allChildren, &allAttributes, &tipCount, debug);
 
   if (!containsKey(&(allAttributes[0]), "TreeName") && !treeName.empty())
   {
@@ -1206,7 +1208,7 @@ static multiPhylo parseNWKAString(std::string* source, bool debug)
 {
   multiPhylo tbr;
 
-  int srPosition = 0;
+  size_t srPosition = 0;
   bool escaping = false;
   bool escaped;
   bool openQuotes = false;
@@ -1221,12 +1223,12 @@ static multiPhylo parseNWKAString(std::string* source, bool debug)
   {
     std::stringstream sb;
 
-    char c = nextToken(source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
+    char c = nextToken(*source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
 
     while (!eof && !(c == ';' && !escaped && !openQuotes && !openApostrophe))
     {
       sb << (char)c;
-      c = nextToken(source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
+      c = nextToken(*source, &srPosition, &escaping, &escaped, &openQuotes, &openApostrophe, &eof);
     }
 
     std::string treeString = sb.str();
@@ -1520,11 +1522,11 @@ static multiPhylo parseNEXUSFile(std::string fileName, bool debug)
         {
           bool tempEof = false;
 
-          int tempSrPosition = 0;
+          size_t tempSrPosition = 0;
 
           std::map<std::string, std::variant<std::string, double>, ci_less> attributes;
 
-          parseAttributes(&preCommentsString, &tempSrPosition, &tempEof, &attributes, 2);
+          parseAttributes(preCommentsString, &tempSrPosition, &tempEof, &attributes, 2);
 
           std::map<std::string, std::variant<std::string, double>, ci_less>::iterator it;
 
@@ -1,797 +1,1084 @@
-/***********************************************************************
- *  write_binary_tree.cpp    2020-05-20
- *  by Giorgio Bianchini
- *  This file is part of the R package TreeNode, licensed under GPLv3
- *
- *  Methods to write trees provided by R to a file in binary tree
- *  format.
- ***********************************************************************/
-
-// [[Rcpp::plugins(cpp17)]]
-
-#include "common.h"
-
-using namespace Rcpp;
-
-//Less comparer used by std::map.
-struct AttributeLess
-{
-  bool operator()(Attribute const& lhs, Attribute const& rhs) const
-  {
-    return lhs.AttributeName.compare(rhs.AttributeName) > 0;
-  }
-};
-
-//Write a single byte to the file stream.
-static void writeByte(std::fstream* stream, byte b)
-{
-  char buf[1];
-
-  buf[0] = (char)b;
-
-  stream->write(buf, 1);
-}
-
-//Write multiple bytes to the file stream.
-static void writeBytes(std::fstream* stream, byte* bytes, size_t count)
-{
-  stream->write((char*)bytes, count);
-}
-
-//Write a double-precision floating point number to the file stream. The
-//numbers should be stored in 64-bit IEEE754 format, hopefully this
-//corresponds to the internal format of double on the current platform.
-static void writeDouble(std::fstream* stream, double value)
-{
-  writeBytes(stream, reinterpret_cast<byte*>(&value), sizeof(value));
-}
-
-//Write a 32-bit wide integer to the file stream (little-endian).
-static void writeInt32(std::fstream* stream, int32_t val)
-{
-  byte buf[4] = { (byte)(val & 0x000000ff),
-                  (byte)((val & 0x0000ff00) >> 8),
-                  (byte)((val & 0x00ff0000) >> 16),
-                  (byte)((val & 0xff000000) >> 24) };
-  writeBytes(stream, buf, 4);
-}
-
-//Write a 64-bit wide integer to the file stream (little-endian).
-static void writeInt64(std::fstream* stream, int64_t val)
-{
-  byte buf[8] = { (byte)(val & 0x00000000000000ffLL),
-                  (byte)((val & 0x000000000000ff00LL) >> 8),
-                  (byte)((val & 0x0000000000ff0000LL) >> 16),
-                  (byte)((val & 0x00000000ff000000LL) >> 24),
-                  (byte)((val & 0x000000ff00000000LL) >> 32),
-                  (byte)((val & 0x0000ff0000000000LL) >> 40),
-                  (byte)((val & 0x00ff000000000000LL) >> 48),
-                  (byte)((val & 0xff00000000000000LL) >> 56) };
-  writeBytes(stream, buf, 8);
-}
-
-//Write a variable-width integer to the file stream. If the integer is
-//smaller than 254, it is only 1-byte wide; otherwise it is 40-bit
-//(5-byte) wide.
-static void writeInt(std::fstream* stream, int32_t val)
-{
-  if (val < 254)
-  {
-    writeByte(stream, (byte)val);
-  }
-  else
-  {
-    writeByte(stream, 254);
-    writeInt32(stream, val);
-  }
-}
-
-//Write a string to the stream. The string should be stored as an
-//integer n representing its length followed by n integers that
-//constitute the UTF-16 representation of the string. Since codecvt_utf8
-//does not apparently work, we are stuck with a straight char->int
-//conversion, which will probably only work for ASCII characters.
-static void writeMyString(std::fstream* stream, std::string val)
-{
-  writeInt(stream, val.length());
-
-  for (size_t i = 0; i < val.length(); i++)
-  {
-    writeInt(stream, (int32_t)val[i]);
-  }
-}
-
-//Write a variable-width integer from the stream. If the integer is equal
-//to 0, 2 or 3, it is 2-bit wide; if it is 1, 4 or 5, it is 4-bit wide;
-//if it is greater than 5, the current byte is padded and the integer is
-//represented as an integer of the format written by readInt in the
-//following byte(s). The initial value of *currByte and *currIndex should
-//be 0. Successive writes should use the same variables, which will have been
-//updated by this method. After the last write, if *currIndex is not 0,
-//it means that the current byte has not been written to the stream yet.
-static int writeShortInt(std::fstream* stream, int32_t value, byte* currByte, int32_t currIndex)
-{
-  if (value == 0)
-  {
-    //00
-    if (currIndex == 0)
-    {
-      return 2;
-    }
-    else if (currIndex == 2)
-    {
-      return 4;
-    }
-    else if (currIndex == 4)
-    {
-      return 6;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, *currByte);
-      *currByte = 0;
-      return 0;
-    }
-  }
-  else if (value == 2)
-  {
-    //01
-    if (currIndex == 0)
-    {
-      *currByte = (byte)(*currByte | 0b00000001);
-      return 2;
-    }
-    else if (currIndex == 2)
-    {
-      *currByte = (byte)(*currByte | 0b00000100);
-      return 4;
-    }
-    else if (currIndex == 4)
-    {
-      *currByte = (byte)(*currByte | 0b00010000);
-      return 6;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b01000000));
-      *currByte = 0;
-      return 0;
-    }
-  }
-  else if (value == 3)
-  {
-    //10
-    if (currIndex == 0)
-    {
-      *currByte = (byte)(*currByte | 0b00000010);
-      return 2;
-    }
-    else if (currIndex == 2)
-    {
-      *currByte = (byte)(*currByte | 0b00001000);
-      return 4;
-    }
-    else if (currIndex == 4)
-    {
-      *currByte = (byte)(*currByte | 0b00100000);
-      return 6;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b10000000));
-      *currByte = 0;
-      return 0;
-    }
-  }
-  else if (value == 1)
-  {
-    //0011
-    if (currIndex == 0)
-    {
-      *currByte = (byte)(*currByte | 0b00000011);
-      return 4;
-    }
-    else if (currIndex == 2)
-    {
-      *currByte = (byte)(*currByte | 0b00001100);
-      return 6;
-    }
-    else if (currIndex == 4)
-    {
-      writeByte(stream, (byte)(*currByte | 0b00110000));
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b11000000));
-      *currByte = 0;
-      return 2;
-    }
-  }
-  else if (value == 4)
-  {
-    //0111
-    if (currIndex == 0)
-    {
-      *currByte = (byte)(*currByte | 0b00000111);
-      return 4;
-    }
-    else if (currIndex == 2)
-    {
-      *currByte = (byte)(*currByte | 0b00011100);
-      return 6;
-    }
-    else if (currIndex == 4)
-    {
-      writeByte(stream, (byte)(*currByte | 0b01110000));
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b11000000));
-      *currByte = 0b00000001;
-      return 2;
-    }
-  }
-  else if (value == 5)
-  {
-    //1011
-    if (currIndex == 0)
-    {
-      *currByte = (byte)(*currByte | 0b00001011);
-      return 4;
-    }
-    else if (currIndex == 2)
-    {
-      *currByte = (byte)(*currByte | 0b00101100);
-      return 6;
-    }
-    else if (currIndex == 4)
-    {
-      writeByte(stream, (byte)(*currByte | 0b10110000));
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b11000000));
-      *currByte = 0b00000010;
-      return 2;
-    }
-  }
-  else
-  {
-    //1111
-    if (currIndex == 0)
-    {
-      writeByte(stream, (byte)(*currByte | 0b00001111));
-      writeInt(stream, value);
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 2)
-    {
-      writeByte(stream, (byte)(*currByte | 0b00111100));
-      writeInt(stream, value);
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 4)
-    {
-      writeByte(stream, (byte)(*currByte | 0b11110000));
-      writeInt(stream, value);
-      *currByte = 0;
-      return 0;
-    }
-    else if (currIndex == 6)
-    {
-      writeByte(stream, (byte)(*currByte | 0b11000000));
-      writeByte(stream, (byte)0b00000011);
-      writeInt(stream, value);
-      *currByte = 0;
-      return 0;
-    }
-  }
-
-  Rcpp::stop("Unexpected code path!");
-}
-
-//Writes a tree in binary format to the file stream.
-static void writeBinaryTree(phylo* tree, std::fstream* file, bool globalNames = false, bool globalAttributes = false, std::map<std::string, size_t>* names = NULL, std::map<Attribute, size_t, AttributeLess>* attributes = NULL, std::vector<Attribute>* attributesLookupReverse = NULL)
-{
-  std::map<Attribute, size_t, AttributeLess> newAttributes;
-  std::vector<Attribute> newAttributesReverse;
-
-  if (!globalAttributes)
-  {
-    attributes = &newAttributes;
-    attributesLookupReverse = &newAttributesReverse;
-
-    for (size_t j = 0; j < tree->attributes.size(); j++)
-    {
-      if (attributes->insert(std::pair<Attribute, size_t>(tree->attributes[j], attributes->size())).second)
-      {
-        attributesLookupReverse->push_back(tree->attributes[j]);
-      }
-    }
-
-    writeInt(file, (int32_t)attributes->size());
-
-    for (size_t i = 0; i < attributes->size(); i++)
-    {
-      writeMyString(file, (*attributesLookupReverse)[i].AttributeName);
-      writeInt(file, (*attributesLookupReverse)[i].IsNumeric ? 2 : 1);
-    }
-  }
-  else
-  {
-    writeByte(file, 0);
-  }
-
-  std::vector<int32_t> parents(tree->Nnode + tree->tipLabel.size() + 1);
-  std::vector<std::vector<int32_t>> children(tree->Nnode + tree->tipLabel.size() + 1);
-
-  std::vector<int32_t> sortedParents(tree->Nnode + tree->tipLabel.size());
-  std::vector<std::vector<int32_t>> sortedChildren(tree->Nnode + tree->tipLabel.size());
-
-  std::vector<int32_t> sortedNodes(tree->Nnode + tree->tipLabel.size());
-
-  for (size_t i = 0; i < tree->edge.size(); i++)
-  {
-    children[tree->edge[i][0]].push_back(tree->edge[i][1]);
-    parents[tree->edge[i][1]] = tree->edge[i][0];
-  }
-
-  int32_t rootNode = -1;
-
-  for (size_t i = 1; i < parents.size(); i++)
-  {
-    if (parents[i] == 0)
-    {
-      rootNode = i;
-      break;
-    }
-  }
-
-  int32_t currIndex = 0;
-
-  addChildren(&children, &sortedParents, &sortedChildren, &sortedNodes, &currIndex, rootNode, -1);
-
-  byte currByte = 0;
-  int32_t currPos = 0;
-
-  for (size_t i = 0; i < sortedChildren.size(); i++)
-  {
-    currPos = writeShortInt(file, (int32_t)sortedChildren[i].size(), &currByte, currPos);
-  }
-
-  if (currPos != 0)
-  {
-    writeByte(file, currByte);
-  }
-
-  int32_t tipCount = (int32_t)tree->tipLabel.size();
-
-  for (size_t i = 0; i < sortedParents.size(); i++)
-  {
-    int32_t currAttributeCount = 0;
-    if (sortedNodes[i] <= tipCount)
-    {
-      for (size_t j = 0; j < attributesLookupReverse->size(); j++)
-      {
-        if ((*attributesLookupReverse)[j].IsNumeric)
-        {
-          double value = std::get<std::vector<double>>(tree->tipAttributes[j])[sortedNodes[i] - 1];
-          if (!std::isnan(value))
-          {
-            currAttributeCount++;
-          }
-        }
-        else
-        {
-          std::string value = std::get<std::vector<std::string>>(tree->tipAttributes[j])[sortedNodes[i] - 1];
-          if (!value.empty())
-          {
-            currAttributeCount++;
-          }
-        }
-      }
-
-      writeInt(file, currAttributeCount);
-
-      for (size_t j = 0; j < attributesLookupReverse->size(); j++)
-      {
-        int32_t index = (*attributes)[(*attributesLookupReverse)[j]];
-
-        if (!(*attributesLookupReverse)[j].IsNumeric && equalCI((*attributesLookupReverse)[j].AttributeName, NAMEATTRIBUTE) && globalNames)
-        {
-          std::string value = std::get<std::vector<std::string>>(tree->tipAttributes[j])[sortedNodes[i] - 1];
-
-          if (!value.empty())
-          {
-            writeInt(file, index);
-
-            /*if (value.length() == 0)
-            {
-              writeByte(file, 0);
-            }
-            else
-            {*/
-              std::map<std::string, size_t>::iterator iter = names->find(value);
-
-              if (iter != names->end())
-              {
-                writeInt(file, iter->second + 1);
-              }
-              else
-              {
-                writeByte(file, 255);
-                writeMyString(file, value);
-              }
-            //}
-          }
-        }
-        else
-        {
-          if ((*attributesLookupReverse)[j].IsNumeric)
-          {
-            double value = std::get<std::vector<double>>(tree->tipAttributes[j])[sortedNodes[i] - 1];
-            if (!std::isnan(value))
-            {
-              writeInt(file, index);
-              writeDouble(file, value);
-            }
-          }
-          else
-          {
-            std::string value = std::get<std::vector<std::string>>(tree->tipAttributes[j])[sortedNodes[i] - 1];
-            if (!value.empty())
-            {
-              writeInt(file, index);
-              writeMyString(file, value);
-            }
-          }
-        }
-      }
-
-    }
-    else
-    {
-      for (size_t j = 0; j < attributesLookupReverse->size(); j++)
-      {
-        if ((*attributesLookupReverse)[j].IsNumeric)
-        {
-          double value = std::get<std::vector<double>>(tree->nodeAttributes[j])[sortedNodes[i] - tipCount - 1];
-          if (!std::isnan(value))
-          {
-            currAttributeCount++;
-          }
-        }
-        else
-        {
-          std::string value = std::get<std::vector<std::string>>(tree->nodeAttributes[j])[sortedNodes[i] - tipCount - 1];
-          if (!value.empty())
-          {
-            currAttributeCount++;
-          }
-        }
-      }
-
-      writeInt(file, currAttributeCount);
-
-      for (size_t j = 0; j < attributesLookupReverse->size(); j++)
-      {
-        int32_t index = (*attributes)[(*attributesLookupReverse)[j]];
-
-        if (!(*attributesLookupReverse)[j].IsNumeric && equalCI((*attributesLookupReverse)[j].AttributeName, NAMEATTRIBUTE) && globalNames)
-        {
-          std::string value = std::get<std::vector<std::string>>(tree->nodeAttributes[j])[sortedNodes[i] - tipCount - 1];
-
-          if (!value.empty())
-          {
-            writeInt(file, index);
-
-            std::map<std::string, size_t>::iterator iter = names->find(value);
-
-            if (iter != names->end())
-            {
-              writeInt(file, iter->second);
-            }
-            else
-            {
-              writeByte(file, 255);
-              writeMyString(file, value);
-            }
-          }
-        }
-        else
-        {
-          if ((*attributesLookupReverse)[j].IsNumeric)
-          {
-            double value = std::get<std::vector<double>>(tree->nodeAttributes[j])[sortedNodes[i] - tipCount - 1];
-            if (!std::isnan(value))
-            {
-              writeInt(file, index);
-              writeDouble(file, value);
-            }
-          }
-          else
-          {
-            std::string value = std::get<std::vector<std::string>>(tree->nodeAttributes[j])[sortedNodes[i] - tipCount - 1];
-            if (!value.empty())
-            {
-              writeInt(file, index);
-              writeMyString(file, value);
-            }
-          }
-        }
-      }
-    }
-  }
-}
-
-//Writes the tree(s) contained in a multiPhylo object to the file stream.
-static void writeBinaryTrees(multiPhylo* trees, std::fstream* file, byte* additionalDataToCopy, size_t additionalDataToCopySize)
-{
-  std::map<std::string, size_t> allNamesLookup;
-  std::vector<std::string> allNamesLookupReverse;
-
-  std::map<Attribute, size_t, AttributeLess> allAttributesLookup;
-  std::vector<Attribute> allAttributesLookupReverse;
-
-  bool includeNamesPerTree = false;
-  bool includeAttributesPerTree = false;
-
-  for (size_t i = 0; i < trees->trees.size(); i++)
-  {
-    size_t prevNameCount = allNamesLookup.size();
-    size_t prevAttributeCount = allAttributesLookup.size();
-
-    size_t count = 0;
-    size_t maxAttributeCount = 0;
-
-    int nameIndex = -1;
-
-    for (size_t j = 0; j < trees->trees[i].attributes.size(); j++)
-    {
-      if (equalCI(trees->trees[i].attributes[j].AttributeName, NAMEATTRIBUTE) && !trees->trees[i].attributes[j].IsNumeric)
-      {
-        nameIndex = j;
-      }
-
-      if (allAttributesLookup.insert(std::pair<Attribute, size_t>(trees->trees[i].attributes[j], allAttributesLookup.size())).second)
-      {
-        allAttributesLookupReverse.push_back(trees->trees[i].attributes[j]);
-      }
-    }
-
-    std::vector<std::string> nodeNames = std::get<std::vector<std::string>>(trees->trees[i].nodeAttributes[nameIndex]);
-    std::vector<std::string> tipNames = std::get<std::vector<std::string>>(trees->trees[i].tipAttributes[nameIndex]);
-
-    for (size_t j = 0; j < nodeNames.size(); j++)
-    {
-      if (nodeNames[j].length() > 0)
-      {
-        count++;
-        if (allNamesLookup.insert(std::pair<std::string, size_t>(nodeNames[j], allNamesLookup.size())).second)
-        {
-          allNamesLookupReverse.push_back(nodeNames[j]);
-        }
-      }
-    }
-
-
-
-
-    for (size_t j = 0; j < tipNames.size(); j++)
-    {
-      if (tipNames[j].length() > 0)
-      {
-        count++;
-        if (allNamesLookup.insert(std::pair<std::string, size_t>(tipNames[j], allNamesLookup.size())).second)
-        {
-          allNamesLookupReverse.push_back(tipNames[j]);
-        }
-      }
-    }
-
-    maxAttributeCount = std::max(maxAttributeCount, std::max(trees->trees[i].nodeAttributes.size(), trees->trees[i].tipAttributes.size()));
-
-    if (prevNameCount != 0 && (allNamesLookup.size() - prevNameCount) * 2 > count)
-    {
-      includeNamesPerTree = true;
-    }
-
-    if (prevAttributeCount != 0 && (allAttributesLookup.size() - prevAttributeCount) * 2 > maxAttributeCount)
-    {
-      includeAttributesPerTree = true;
-    }
-
-    if (includeNamesPerTree && includeAttributesPerTree)
-    {
-      break;
-    }
-  }
-
-  byte header[4] = { 0x23, 0x54, 0x52, 0x45 };
-  writeBytes(file, header, 4);
-
-  if (!includeNamesPerTree && !includeAttributesPerTree)
-  {
-    writeByte(file, 0b00000011);
-  }
-  else if (!includeNamesPerTree && includeAttributesPerTree)
-  {
-    writeByte(file, 0b00000001);
-  }
-  else if (includeNamesPerTree && !includeAttributesPerTree)
-  {
-    writeByte(file, 0b00000010);
-  }
-  else
-  {
-    writeByte(file, 0b00000000);
-  }
-
-  if (!includeNamesPerTree)
-  {
-    writeInt(file, (int32_t)allNamesLookup.size());
-
-    for (size_t i = 0; i < allNamesLookup.size(); i++)
-    {
-      writeMyString(file, allNamesLookupReverse[i]);
-    }
-  }
-
-  if (!includeAttributesPerTree)
-  {
-    writeInt(file, (int32_t)allAttributesLookup.size());
-
-    for (size_t i = 0; i < allAttributesLookup.size(); i++)
-    {
-      writeMyString(file, allAttributesLookupReverse[i].AttributeName);
-      writeInt(file, allAttributesLookupReverse[i].IsNumeric ? 2 : 1);
-    }
-  }
-
-  std::vector<int64_t> addresses(trees->trees.size());
-
-  for (size_t i = 0; i < trees->trees.size(); i++)
-  {
-    addresses[i] = file->tellp();
-    writeBinaryTree(&(trees->trees[i]), file, !includeNamesPerTree, !includeAttributesPerTree, &allNamesLookup, &allAttributesLookup, &allAttributesLookupReverse);
-  }
-
-  if (additionalDataToCopySize > 0)
-  {
-    writeBytes(file, additionalDataToCopy, additionalDataToCopySize);
-  }
-
-  int64_t labelAddress = file->tellp();
-
-  writeInt(file, (int32_t)addresses.size());
-
-  for (size_t i = 0; i < addresses.size(); i++)
-  {
-    writeInt64(file, addresses[i]);
-  }
-
-  writeInt64(file, labelAddress);
-
-  byte trailer[4] = { 0x45, 0x4e, 0x44, 0xff };
-  writeBytes(file, trailer, 4);
-}
-
-//Initialises a file in binary tree format by writing an empty header.
-static void beginWritingBinaryTrees(std::fstream* file)
-{
-  byte header[4] = { 0x23, 0x54, 0x52, 0x45 };
-  writeBytes(file, header, 4);
-  writeByte(file, 0b00000000);
-}
-
-//Finalises a file in binary tree format by writing a trailer containing the
-//tree addresses.
-static void finishWritingBinaryTrees(std::fstream* file, std::vector<int64_t>* addresses, byte* additionalDataToCopy, size_t additionalDataToCopySize)
-{
-  if (additionalDataToCopySize > 0)
-  {
-    writeBytes(file, additionalDataToCopy, additionalDataToCopySize);
-  }
-
-  int64_t labelAddress = (*addresses)[addresses->size() - 1] + additionalDataToCopySize;
-
-  writeInt(file, (int32_t)addresses->size() - 1);
-
-  for (size_t i = 0; i < addresses->size() - 1; i++)
-  {
-    writeInt64(file, (*addresses)[i]);
-  }
-
-  writeInt64(file, labelAddress);
-
-  byte trailer[4] = { 0x45, 0x4e, 0x44, 0xff };
-  writeBytes(file, trailer, 4);
-}
-
-//Writes tree(s) provided by R into a file in binary format.
-//[[Rcpp::export]]
-void Rcpp_write_binary_trees(Rcpp::List trees, std::string fileName, std::vector<Rbyte> additionalData)
-{
-  multiPhylo convertedTrees = convertTrees(&trees);
-
-  std::fstream file(fileName, std::fstream::binary | std::fstream::out);
-
-  if (!file.is_open())
-  {
-    Rcpp::stop("ERROR! Could not open the file for writing.");
-  }
-
-  writeBinaryTrees(&convertedTrees, &file, additionalData.data(), additionalData.size());
-
-  file.close();
-}
-
-//Initialises a file in binary tree format by writing an empty header.
-//Returns a vector of integers intended to store the addresses of the trees
-//that will be written to the file.
-//[[Rcpp::export]]
-std::vector<int64_t> Rcpp_begin_writing_binary_trees(std::string fileName)
-{
-  std::vector<int64_t> addresses;
-
-  std::fstream file(fileName, std::fstream::binary | std::fstream::out);
-
-  if (!file.is_open())
-  {
-    Rcpp::stop("ERROR! Could not open the file for writing.");
-  }
-
-  beginWritingBinaryTrees(&file);
-
-  int64_t address = file.tellp();
-  addresses.push_back(address);
-
-  file.close();
-  return addresses;
-}
-
-//Writes a single tree in binary format to a file. Requires a vector of
-//integers containing the addresses of trees previously written to the file.
-//This vector is updated and returned to R. The last entry in this vector
-//represents what will be the address of the trailer.
-//[[Rcpp::export]]
-std::vector<int64_t> Rcpp_write_binary_tree(Rcpp::List tree, std::string fileName, std::vector<int64_t> addresses)
-{
-  phylo convertedTree = convertTree(&tree);
-  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
-
-  if (!file.is_open())
-  {
-    Rcpp::stop("ERROR! Could not open the file for writing.");
-  }
-
-  writeBinaryTree(&convertedTree, &file);
-  int64_t address = file.tellp();
-  addresses.push_back(address);
-  file.close();
-  return addresses;
-}
-
-//Finalises a file in binary tree format by writing a trailer containing the
-//tree addresses (provided by R).
-//[[Rcpp::export]]
-void Rcpp_finish_writing_binary_trees(std::string fileName, std::vector<int64_t> addresses, std::vector<Rbyte> additionalData)
-{
-  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
-
-  if (!file.is_open())
-  {
-    Rcpp::stop("ERROR! Could not open the file for writing.");
-  }
-
-  finishWritingBinaryTrees(&file, &addresses, additionalData.data(), additionalData.size());
-  file.close();
-}
+/***********************************************************************
+ *  write_binary_tree.cpp    2020-05-20
+ *  by Giorgio Bianchini
+ *  This file is part of the R package TreeNode, licensed under GPLv3
+ *
+ *  Methods to write trees provided by R to a file in binary tree
+ *  format.
+ ***********************************************************************/
+
+// [[Rcpp::plugins(cpp17)]]
+
+#include "common.h"
+#include "binary_output.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+using namespace Rcpp;
+
+//Hash and equality comparer for attributes, used by std::unordered_map. Like
+//the comparer previously used with std::map, they only take into account the
+//(case-sensitive) name of the attribute.
+struct AttributeHash
+{
+  size_t operator()(Attribute const& attribute) const
+  {
+    return std::hash<std::string>()(attribute.AttributeName);
+  }
+};
+
+struct AttributeEqual
+{
+  bool operator()(Attribute const& lhs, Attribute const& rhs) const
+  {
+    return lhs.AttributeName == rhs.AttributeName;
+  }
+};
+
+//Dictionaries associating each name or attribute with its index. The names
+//are views of the strings stored in the trees that are being written, which
+//must outlive the dictionary.
+typedef std::unordered_map<std::string_view, size_t> NameLookup;
+typedef std::unordered_map<Attribute, size_t, AttributeHash, AttributeEqual> AttributeLookup;
+
+//Codes used to represent the short ints from 0 to 5 (least significant
+//bits first) and their width in bits.
+static const byte shortIntCodes[6] = { 0b00, 0b0011, 0b01, 0b10, 0b0111, 0b1011 };
+static const int32_t shortIntWidths[6] = { 2, 4, 2, 2, 4, 4 };
+
+//Write a variable-width integer to the stream. If the integer is equal
+//to 0, 2 or 3, it is 2-bit wide; if it is 1, 4 or 5, it is 4-bit wide;
+//if it is greater than 5, the current byte is padded and the integer is
+//represented as an integer of the format written by readInt in the
+//following byte(s). The initial value of *currByte and *currIndex should
+//be 0. Successive writes should use the same variables, which will have been
+//updated by this method. After the last write, if *currIndex is not 0,
+//it means that the current byte has not been written to the stream yet.
+static int writeShortInt(BinaryOutput* stream, int32_t value, byte* currByte, int32_t currIndex)
+{
+  if (value >= 0 && value <= 5)
+  {
+    //A 4-bit code starting at bit 6 spills over into the next byte.
+    uint32_t bits = (uint32_t)(*currByte) | ((uint32_t)shortIntCodes[value] << currIndex);
+    currIndex += shortIntWidths[value];
+
+    if (currIndex >= 8)
+    {
+      writeByte(stream, (byte)bits);
+      bits >>= 8;
+      currIndex -= 8;
+    }
+
+    *currByte = (byte)bits;
+    return currIndex;
+  }
+  else
+  {
+    //1111, followed by padding and by the value as an int.
+    uint32_t bits = (uint32_t)(*currByte) | (0b1111u << currIndex);
+
+    writeByte(stream, (byte)bits);
+
+    if (currIndex == 6)
+    {
+      writeByte(stream, (byte)(bits >> 8));
+    }
+
+    writeInt(stream, value);
+    *currByte = 0;
+    return 0;
+  }
+}
+
+//Writes the attributes of a node in binary format to the output. The values
+//of the attributes are taken from element node of each column in *values.
+//attributeIndices contains the index of each attribute of the tree within the
+//list of attributes that is in use (global or local), and attributeIsName
+//specifies whether the values of each attribute should be written as
+//references to the global names.
+static void writeNodeAttributes(BinaryOutput* file, phylo* tree, std::vector<std::variant<std::vector<std::string>, std::vector<double>>>* values, size_t node, const std::vector<int32_t>* attributeIndices, const std::vector<bool>* attributeIsName, NameLookup* names)
+{
+  int32_t currAttributeCount = 0;
+
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    if (tree->attributes[j].IsNumeric)
+    {
+      if (!std::isnan(std::get<std::vector<double>>((*values)[j])[node]))
+      {
+        currAttributeCount++;
+      }
+    }
+    else
+    {
+      if (!std::get<std::vector<std::string>>((*values)[j])[node].empty())
+      {
+        currAttributeCount++;
+      }
+    }
+  }
+
+  writeInt(file, currAttributeCount);
+
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    int32_t index = (*attributeIndices)[j];
+
+    if (tree->attributes[j].IsNumeric)
+    {
+      double value = std::get<std::vector<double>>((*values)[j])[node];
+      if (!std::isnan(value))
+      {
+        writeInt(file, index);
+        writeDouble(file, value);
+      }
+    }
+    else
+    {
+      const std::string& value = std::get<std::vector<std::string>>((*values)[j])[node];
+
+      if (!value.empty())
+      {
+        writeInt(file, index);
+
+        if ((*attributeIsName)[j])
+        {
+          NameLookup::iterator iter = names->find(value);
+
+          if (iter != names->end())
+          {
+            writeInt(file, iter->second + 1);
+          }
+          else
+          {
+            writeByte(file, 255);
+            writeMyString(file, value);
+          }
+        }
+        else
+        {
+          writeMyString(file, value);
+        }
+      }
+    }
+  }
+}
+
+//Determines whether every attribute of a tree is among the global attributes,
+//with the same type. The global attributes are looked up by name only, so an
+//attribute whose values are numbers in some trees and strings in others has
+//the type with which it was first added.
+static bool hasGlobalAttributes(phylo* tree, AttributeLookup* attributes, std::vector<Attribute>* attributesLookupReverse)
+{
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    AttributeLookup::iterator iter = attributes->find(tree->attributes[j]);
+
+    if (iter == attributes->end() || (*attributesLookupReverse)[iter->second].IsNumeric != tree->attributes[j].IsNumeric)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//Writes a tree in binary format to the output. The global names and
+//attributes are only read, so multiple trees can be written concurrently
+//(to different outputs) using the same maps. If globalAttributes is true but
+//some attributes of the tree are not among the global attributes (or have a
+//different type), the tree includes its own list of attributes instead.
+static void writeBinaryTree(phylo* tree, BinaryOutput* file, bool globalNames = false, bool globalAttributes = false, NameLookup* names = NULL, AttributeLookup* attributes = NULL, std::vector<Attribute>* attributesLookupReverse = NULL)
+{
+  AttributeLookup newAttributes;
+  std::vector<Attribute> newAttributesReverse;
+
+  if (globalAttributes && !hasGlobalAttributes(tree, attributes, attributesLookupReverse))
+  {
+    globalAttributes = false;
+  }
+
+  if (!globalAttributes)
+  {
+    attributes = &newAttributes;
+    attributesLookupReverse = &newAttributesReverse;
+
+    for (size_t j = 0; j < tree->attributes.size(); j++)
+    {
+      if (attributes->insert(std::pair<Attribute, size_t>(tree->attributes[j], attributes->size())).second)
+      {
+        attributesLookupReverse->push_back(tree->attributes[j]);
+      }
+    }
+
+    writeInt(file, (int32_t)attributes->size());
+
+    for (size_t i = 0; i < attributes->size(); i++)
+    {
+      writeMyString(file, (*attributesLookupReverse)[i].AttributeName);
+      writeInt(file, (*attributesLookupReverse)[i].IsNumeric ? 2 : 1);
+    }
+  }
+  else
+  {
+    writeByte(file, 0);
+  }
+
+  //The attributes of the tree are looked up once, rather than for each node.
+  std::vector<int32_t> attributeIndices(tree->attributes.size());
+  std::vector<bool> attributeIsName(tree->attributes.size());
+
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    attributeIndices[j] = (int32_t)attributes->at(tree->attributes[j]);
+    attributeIsName[j] = globalNames && !tree->attributes[j].IsNumeric && equalCI(tree->attributes[j].AttributeName, NAMEATTRIBUTE);
+  }
+
+  std::vector<int32_t> parents(tree->Nnode + tree->tipLabel.size() + 1);
+  std::vector<std::vector<int32_t>> children(tree->Nnode + tree->tipLabel.size() + 1);
+
+  std::vector<int32_t> sortedParents(tree->Nnode + tree->tipLabel.size());
+  std::vector<std::vector<int32_t>> sortedChildren(tree->Nnode + tree->tipLabel.size());
+
+  std::vector<int32_t> sortedNodes(tree->Nnode + tree->tipLabel.size());
+
+  for (size_t i = 0; i < tree->edge.size(); i++)
+  {
+    children[tree->edge[i][0]].push_back(tree->edge[i][1]);
+    parents[tree->edge[i][1]] = tree->edge[i][0];
+  }
+
+  int32_t rootNode = -1;
+
+  for (size_t i = 1; i < parents.size(); i++)
+  {
+    if (parents[i] == 0)
+    {
+      rootNode = i;
+      break;
+    }
+  }
+
+  int32_t currIndex = 0;
+
+  addChildren(&children, &sortedParents, &sortedChildren, &sortedNodes, &currIndex, rootNode, -1);
+
+  byte currByte = 0;
+  int32_t currPos = 0;
+
+  for (size_t i = 0; i < sortedChildren.size(); i++)
+  {
+    currPos = writeShortInt(file, (int32_t)sortedChildren[i].size(), &currByte, currPos);
+  }
+
+  if (currPos != 0)
+  {
+    writeByte(file, currByte);
+  }
+
+  int32_t tipCount = (int32_t)tree->tipLabel.size();
+
+  for (size_t i = 0; i < sortedParents.size(); i++)
+  {
+    if (sortedNodes[i] <= tipCount)
+    {
+      writeNodeAttributes(file, tree, &tree->tipAttributes, sortedNodes[i] - 1, &attributeIndices, &attributeIsName, names);
+    }
+    else
+    {
+      writeNodeAttributes(file, tree, &tree->nodeAttributes, sortedNodes[i] - tipCount - 1, &attributeIndices, &attributeIsName, names);
+    }
+  }
+}
+
+//Add the non-empty names from a column of the Name attribute to the
+//dictionary, without copying them. Returns the number of non-empty names.
+static size_t addNames(const std::vector<std::string>* names, NameLookup* lookup, std::vector<std::string_view>* lookupReverse)
+{
+  size_t count = 0;
+
+  for (size_t i = 0; i < names->size(); i++)
+  {
+    std::string_view name = (*names)[i];
+
+    if (!name.empty())
+    {
+      count++;
+
+      if (lookup->try_emplace(name, lookup->size()).second)
+      {
+        lookupReverse->push_back(name);
+      }
+    }
+  }
+
+  return count;
+}
+
+//Writes a list of global names, in the format used in the header of the file.
+void writeGlobalNames(BinaryOutput* file, const std::vector<std::string_view>* names)
+{
+  writeInt(file, (int32_t)names->size());
+
+  for (size_t i = 0; i < names->size(); i++)
+  {
+    writeMyString(file, (*names)[i]);
+  }
+}
+
+//Writes a list of global attributes, in the format used in the header of the
+//file.
+void writeGlobalAttributes(BinaryOutput* file, const std::vector<Attribute>* attributes)
+{
+  writeInt(file, (int32_t)attributes->size());
+
+  for (size_t i = 0; i < attributes->size(); i++)
+  {
+    writeMyString(file, (*attributes)[i].AttributeName);
+    writeInt(file, (*attributes)[i].IsNumeric ? 2 : 1);
+  }
+}
+
+//Number of trees encoded by each thread before the encoded trees are written
+//to the output, when writing trees in parallel.
+static const size_t TREES_PER_THREAD_BATCH = 64;
+
+//Writes the trees contained in a multiPhylo object to the output (after the
+//header has been written), using multiple threads. The trees are processed
+//in batches: within each batch, each thread encodes the next tree that has
+//not been claimed yet into its own buffer; the buffers are then appended to
+//the output in order, and the address of each tree is determined from the
+//length of the buffers that precede it. If encoding any of the trees fails,
+//the first exception is rethrown after all the threads have stopped. The
+//worker threads must not call into R.
+static void writeBinaryTreesInParallel(multiPhylo* trees, BinaryOutput* file, int threads, bool globalNames, bool globalAttributes, NameLookup* names, AttributeLookup* attributes, std::vector<Attribute>* attributesLookupReverse, std::vector<int64_t>* addresses)
+{
+  size_t treeCount = trees->trees.size();
+  size_t batchSize = (size_t)threads * TREES_PER_THREAD_BATCH;
+
+  std::vector<BinaryOutput> buffers(std::min(batchSize, treeCount));
+
+  for (size_t batchStart = 0; batchStart < treeCount; batchStart += batchSize)
+  {
+    size_t batchEnd = std::min(batchStart + batchSize, treeCount);
+
+    std::atomic<size_t> nextTree(batchStart);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error = NULL;
+    std::mutex errorMutex;
+
+    auto worker = [&]()
+    {
+      try
+      {
+        for (size_t i = nextTree++; i < batchEnd && !failed; i = nextTree++)
+        {
+          BinaryOutput* buffer = &buffers[i - batchStart];
+          buffer->buffer.clear();
+
+          writeBinaryTree(&(trees->trees[i]), buffer, globalNames, globalAttributes, names, attributes, attributesLookupReverse);
+        }
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(errorMutex);
+
+        if (!failed)
+        {
+          error = std::current_exception();
+          failed = true;
+        }
+      }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int i = 0; i < threads && (size_t)i < batchEnd - batchStart; i++)
+    {
+      workers.push_back(std::thread(worker));
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      workers[i].join();
+    }
+
+    if (failed)
+    {
+      std::rethrow_exception(error);
+    }
+
+    for (size_t i = batchStart; i < batchEnd; i++)
+    {
+      std::vector<byte>* buffer = &buffers[i - batchStart].buffer;
+
+      (*addresses)[i] = outputPosition(file);
+      writeBytes(file, buffer->data(), buffer->size());
+      flushOutputIfFull(file);
+    }
+  }
+}
+
+//Writes the tree(s) contained in a multiPhylo object to the output. The
+//addresses of the trees are determined from the position of the output, and
+//the output is flushed to the file whenever the buffer is full. If threads is
+//greater than 1, the trees are encoded in parallel.
+static void writeBinaryTrees(multiPhylo* trees, BinaryOutput* file, byte* additionalDataToCopy, size_t additionalDataToCopySize, int threads = 1)
+{
+  NameLookup allNamesLookup;
+  std::vector<std::string_view> allNamesLookupReverse;
+
+  AttributeLookup allAttributesLookup;
+  std::vector<Attribute> allAttributesLookupReverse;
+
+  //Whether the name of each attribute in the dictionary is Name (compared
+  //case-insensitively), so that this is only checked once per attribute.
+  std::vector<bool> allAttributesAreNames;
+
+  bool includeNamesPerTree = false;
+  bool includeAttributesPerTree = false;
+
+  for (size_t i = 0; i < trees->trees.size(); i++)
+  {
+    phylo* tree = &trees->trees[i];
+
+    size_t prevNameCount = allNamesLookup.size();
+    size_t prevAttributeCount = allAttributesLookup.size();
+
+    size_t count = 0;
+    size_t maxAttributeCount = 0;
+
+    int nameIndex = -1;
+
+    for (size_t j = 0; j < tree->attributes.size(); j++)
+    {
+      std::pair<AttributeLookup::iterator, bool> inserted = allAttributesLookup.try_emplace(tree->attributes[j], allAttributesLookup.size());
+
+      if (inserted.second)
+      {
+        allAttributesLookupReverse.push_back(tree->attributes[j]);
+        allAttributesAreNames.push_back(equalCI(tree->attributes[j].AttributeName, NAMEATTRIBUTE));
+      }
+
+      if (allAttributesAreNames[inserted.first->second] && !tree->attributes[j].IsNumeric)
+      {
+        nameIndex = j;
+      }
+    }
+
+    if (nameIndex >= 0)
+    {
+      count += addNames(&std::get<std::vector<std::string>>(tree->nodeAttributes[nameIndex]), &allNamesLookup, &allNamesLookupReverse);
+      count += addNames(&std::get<std::vector<std::string>>(tree->tipAttributes[nameIndex]), &allNamesLookup, &allNamesLookupReverse);
+    }
+
+    maxAttributeCount = std::max(maxAttributeCount, std::max(tree->nodeAttributes.size(), tree->tipAttributes.size()));
+
+    if (prevNameCount != 0 && (allNamesLookup.size() - prevNameCount) * 2 > count)
+    {
+      includeNamesPerTree = true;
+    }
+
+    if (prevAttributeCount != 0 && (allAttributesLookup.size() - prevAttributeCount) * 2 > maxAttributeCount)
+    {
+      includeAttributesPerTree = true;
+    }
+
+    if (includeNamesPerTree && includeAttributesPerTree)
+    {
+      break;
+    }
+  }
+
+  byte header[4] = { 0x23, 0x54, 0x52, 0x45 };
+  writeBytes(file, header, 4);
+
+  if (!includeNamesPerTree && !includeAttributesPerTree)
+  {
+    writeByte(file, 0b00000011);
+  }
+  else if (!includeNamesPerTree && includeAttributesPerTree)
+  {
+    writeByte(file, 0b00000001);
+  }
+  else if (includeNamesPerTree && !includeAttributesPerTree)
+  {
+    writeByte(file, 0b00000010);
+  }
+  else
+  {
+    writeByte(file, 0b00000000);
+  }
+
+  if (!includeNamesPerTree)
+  {
+    writeGlobalNames(file, &allNamesLookupReverse);
+  }
+
+  if (!includeAttributesPerTree)
+  {
+    writeGlobalAttributes(file, &allAttributesLookupReverse);
+  }
+
+  std::vector<int64_t> addresses(trees->trees.size());
+
+  if (threads > 1 && trees->trees.size() > 1)
+  {
+    writeBinaryTreesInParallel(trees, file, threads, !includeNamesPerTree, !includeAttributesPerTree, &allNamesLookup, &allAttributesLookup, &allAttributesLookupReverse, &addresses);
+  }
+  else
+  {
+    for (size_t i = 0; i < trees->trees.size(); i++)
+    {
+      addresses[i] = outputPosition(file);
+      writeBinaryTree(&(trees->trees[i]), file, !includeNamesPerTree, !includeAttributesPerTree, &allNamesLookup, &allAttributesLookup, &allAttributesLookupReverse);
+      flushOutputIfFull(file);
+    }
+  }
+
+  if (additionalDataToCopySize > 0)
+  {
+    writeBytes(file, additionalDataToCopy, additionalDataToCopySize);
+  }
+
+  int64_t labelAddress = outputPosition(file);
+
+  writeInt(file, (int32_t)addresses.size());
+
+  for (size_t i = 0; i < addresses.size(); i++)
+  {
+    writeInt64(file, addresses[i]);
+  }
+
+  writeInt64(file, labelAddress);
+
+  byte trailer[4] = { 0x45, 0x4e, 0x44, 0xff };
+  writeBytes(file, trailer, 4);
+
+  flushOutput(file);
+}
+
+//Initialises a file in binary tree format by writing an empty header. If
+//deferredGlobals is true, the header states that the file uses global names
+//and attributes, which will be stored in a dictionary block referenced by the
+//trailer (see writeGlobalDictionary).
+static void beginWritingBinaryTrees(BinaryOutput* file, bool deferredGlobals = false)
+{
+  byte header[4] = { 0x23, 0x54, 0x52, 0x45 };
+  writeBytes(file, header, 4);
+  writeByte(file, deferredGlobals ? 0b00000111 : 0b00000000);
+}
+
+//Finalises a file in binary tree format by writing a trailer containing the
+//tree addresses. If dictionaryAddress is not negative, it is the address of
+//the block containing the global names and attributes, which is included in
+//the trailer. The output is flushed to the file.
+void finishWritingBinaryTrees(BinaryOutput* file, std::vector<int64_t>* addresses, const byte* additionalDataToCopy, size_t additionalDataToCopySize, int64_t dictionaryAddress)
+{
+  if (additionalDataToCopySize > 0)
+  {
+    writeBytes(file, additionalDataToCopy, additionalDataToCopySize);
+  }
+
+  int64_t labelAddress = (*addresses)[addresses->size() - 1] + additionalDataToCopySize;
+
+  writeInt(file, (int32_t)addresses->size() - 1);
+
+  for (size_t i = 0; i < addresses->size() - 1; i++)
+  {
+    writeInt64(file, (*addresses)[i]);
+  }
+
+  if (dictionaryAddress >= 0)
+  {
+    writeInt64(file, dictionaryAddress);
+  }
+
+  writeInt64(file, labelAddress);
+
+  byte trailer[4] = { 0x45, 0x4e, 0x44, 0xff };
+  writeBytes(file, trailer, 4);
+
+  flushOutput(file);
+}
+
+//Writes trees at the end of an existing file in binary tree format (after the
+//existing trees, whose addresses are in the metadata), followed by the global
+//dictionary block (if the file has one), the additional data and a new
+//trailer. The trees are encoded using the global names and attributes of the
+//file, which are not changed: names that are not among the global names are
+//stored in full, and trees that have attributes which are not among the
+//global attributes (or have a different type) include their own list of
+//attributes.
+void appendBinaryTrees(multiPhylo* trees, BinaryOutput* file, const BinaryTreeMetadata* metadata, byte* additionalDataToCopy, size_t additionalDataToCopySize)
+{
+  NameLookup names;
+  std::vector<std::string_view> namesReverse;
+
+  for (size_t i = 0; i < metadata->names.size(); i++)
+  {
+    names.try_emplace(metadata->names[i], i);
+    namesReverse.push_back(metadata->names[i]);
+  }
+
+  AttributeLookup attributes;
+  std::vector<Attribute> attributesReverse = metadata->attributes;
+
+  for (size_t i = 0; i < metadata->attributes.size(); i++)
+  {
+    attributes.try_emplace(metadata->attributes[i], i);
+  }
+
+  std::vector<int64_t> addresses = metadata->treeAddresses;
+
+  for (size_t i = 0; i < trees->trees.size(); i++)
+  {
+    addresses.push_back(outputPosition(file));
+    writeBinaryTree(&trees->trees[i], file, metadata->globalNames, metadata->globalAttributes, &names, &attributes, &attributesReverse);
+    flushOutputIfFull(file);
+  }
+
+  int64_t dictionaryAddress = -1;
+
+  if (metadata->deferredGlobals)
+  {
+    dictionaryAddress = outputPosition(file);
+
+    if (metadata->globalNames)
+    {
+      writeGlobalNames(file, &namesReverse);
+    }
+
+    if (metadata->globalAttributes)
+    {
+      writeGlobalAttributes(file, &attributesReverse);
+    }
+  }
+
+  addresses.push_back(outputPosition(file));
+
+  finishWritingBinaryTrees(file, &addresses, additionalDataToCopy, additionalDataToCopySize, dictionaryAddress);
+}
+
+//Writes tree(s) provided by R into a file in binary format. If threads is
+//greater than 1, the trees are encoded in parallel; if it is 0 or negative,
+//a thread is used for each available core.
+//[[Rcpp::export]]
+void Rcpp_write_binary_trees(Rcpp::List trees, std::string fileName, std::vector<Rbyte> additionalData, int threads)
+{
+  multiPhylo convertedTrees = convertTrees(&trees);
+
+  std::fstream file(fileName, std::fstream::binary | std::fstream::out);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  BinaryOutput output(&file);
+
+  writeBinaryTrees(&convertedTrees, &output, additionalData.data(), additionalData.size(), resolveThreads(threads));
+
+  file.close();
+}
+
+//Initialises a file in binary tree format by writing an empty header.
+//Returns a vector of integers intended to store the addresses of the trees
+//that will be written to the file.
+//[[Rcpp::export]]
+std::vector<int64_t> Rcpp_begin_writing_binary_trees(std::string fileName)
+{
+  std::vector<int64_t> addresses;
+
+  std::fstream file(fileName, std::fstream::binary | std::fstream::out);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  BinaryOutput output(&file);
+
+  beginWritingBinaryTrees(&output);
+  flushOutput(&output);
+
+  addresses.push_back(outputPosition(&output));
+
+  file.close();
+  return addresses;
+}
+
+//Writes a single tree in binary format to a file. Requires a vector of
+//integers containing the addresses of trees previously written to the file.
+//This vector is updated and returned to R. The last entry in this vector
+//represents what will be the address of the trailer.
+//[[Rcpp::export]]
+std::vector<int64_t> Rcpp_write_binary_tree(Rcpp::List tree, std::string fileName, std::vector<int64_t> addresses)
+{
+  phylo convertedTree = convertTree(&tree);
+  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  file.seekp(0, std::ios::end);
+  BinaryOutput output(&file, file.tellp());
+
+  writeBinaryTree(&convertedTree, &output);
+  flushOutput(&output);
+
+  addresses.push_back(outputPosition(&output));
+  file.close();
+  return addresses;
+}
+
+//Finalises a file in binary tree format by writing a trailer containing the
+//tree addresses (provided by R).
+//[[Rcpp::export]]
+void Rcpp_finish_writing_binary_trees(std::string fileName, std::vector<int64_t> addresses, std::vector<Rbyte> additionalData)
+{
+  std::fstream file(fileName, std::fstream::binary | std::fstream::app);
+
+  if (!file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  BinaryOutput output(&file);
+
+  finishWritingBinaryTrees(&output, &addresses, additionalData.data(), additionalData.size());
+  file.close();
+}
+
+//A file in binary tree format that is kept open while trees are written to
+//it, keeping track of their addresses. If globalDictionaries is true, the
+//names and attributes of the trees are collected into global dictionaries as
+//the trees are written, and the dictionaries are written to the file when it
+//is closed. The names are owned by the writer (nameStorage does not move its
+//elements when it grows, so the views in the lookup remain valid).
+//If checkpointTrees or checkpointSeconds are greater than 0, the file ends
+//with a valid trailer between checkpoints: the trees written since the last
+//checkpoint are kept in memory (the output has no file), and at each
+//checkpoint they are written in place of the previous trailer, followed by a
+//new one. The end marker of the previous trailer is invalidated first, so
+//that while a checkpoint is being written the file has no valid trailer
+//(rather than a stale one). Since the dictionaries and the trailer only grow,
+//the file never shrinks, and the bytes before checkpointAddress are never
+//modified.
+struct BinaryTreeWriter
+{
+  BinaryTreeWriter(const std::string& fileName, bool globalDictionaries, int checkpointTrees, double checkpointSeconds) : fileName(fileName), file(fileName, std::fstream::binary | std::fstream::out), output(checkpointTrees > 0 || checkpointSeconds > 0 ? NULL : &file), checkpointTrees(checkpointTrees), checkpointSeconds(checkpointSeconds), lastCheckpointTime(std::chrono::steady_clock::now()), globalDictionaries(globalDictionaries) { }
+
+  std::string fileName;
+  std::fstream file;
+  BinaryOutput output;
+  std::vector<int64_t> addresses;
+
+  int checkpointTrees;
+  double checkpointSeconds;
+
+  //Number of trees in the file and time at the last checkpoint (or when the
+  //file was created).
+  size_t lastCheckpointTrees = 0;
+  std::chrono::steady_clock::time_point lastCheckpointTime;
+
+  //Address at which the contents of the output buffer will be written at the
+  //next checkpoint (i.e., where the trailer of the last checkpoint starts), or
+  //-1 if checkpoints are not enabled.
+  int64_t checkpointAddress = -1;
+
+  bool globalDictionaries;
+  std::deque<std::string> nameStorage;
+  NameLookup names;
+  std::vector<std::string_view> namesReverse;
+  AttributeLookup attributes;
+  std::vector<Attribute> attributesReverse;
+};
+
+//Add the non-empty names from a column of the Name attribute to the global
+//dictionary of the writer, copying the ones that are not there yet.
+static void addWriterNames(BinaryTreeWriter* writer, const std::vector<std::string>* names)
+{
+  for (size_t i = 0; i < names->size(); i++)
+  {
+    const std::string& name = (*names)[i];
+
+    if (!name.empty() && writer->names.find(name) == writer->names.end())
+    {
+      writer->nameStorage.push_back(name);
+      writer->names.emplace(writer->nameStorage.back(), writer->namesReverse.size());
+      writer->namesReverse.push_back(writer->nameStorage.back());
+    }
+  }
+}
+
+//Add the attributes of a tree, and the values of its Name attribute, to the
+//global dictionaries of the writer. The entries that are already in the
+//dictionaries keep their index, so that the trees that have already been
+//written remain valid.
+static void addToDictionaries(BinaryTreeWriter* writer, phylo* tree)
+{
+  for (size_t j = 0; j < tree->attributes.size(); j++)
+  {
+    if (writer->attributes.try_emplace(tree->attributes[j], writer->attributes.size()).second)
+    {
+      writer->attributesReverse.push_back(tree->attributes[j]);
+    }
+
+    if (!tree->attributes[j].IsNumeric && equalCI(tree->attributes[j].AttributeName, NAMEATTRIBUTE))
+    {
+      addWriterNames(writer, &std::get<std::vector<std::string>>(tree->tipAttributes[j]));
+      addWriterNames(writer, &std::get<std::vector<std::string>>(tree->nodeAttributes[j]));
+    }
+  }
+}
+
+//Get the writer from an external pointer created by Rcpp_open_binary_tree_writer.
+static BinaryTreeWriter* getWriter(SEXP handle)
+{
+  Rcpp::XPtr<BinaryTreeWriter> writer(handle);
+
+  if (writer.get() == NULL)
+  {
+    Rcpp::stop("The tree writer has already been closed!");
+  }
+
+  return writer.get();
+}
+
+//Writes the global names and attributes collected by a writer to the output,
+//returning the address of the block containing them.
+static int64_t writeGlobalDictionary(BinaryTreeWriter* writer)
+{
+  int64_t dictionaryAddress = outputPosition(&writer->output);
+
+  writeGlobalNames(&writer->output, &writer->namesReverse);
+  writeGlobalAttributes(&writer->output, &writer->attributesReverse);
+
+  return dictionaryAddress;
+}
+
+//Write the global dictionary block (if necessary), the additional data and
+//the trailer to the output of a writer, after the trees that have been
+//written so far.
+static void writeWriterTrailer(BinaryTreeWriter* writer, const byte* additionalData, size_t additionalDataSize)
+{
+  int64_t dictionaryAddress = -1;
+
+  if (writer->globalDictionaries)
+  {
+    dictionaryAddress = writeGlobalDictionary(writer);
+  }
+
+  std::vector<int64_t> addresses = writer->addresses;
+  addresses.push_back(outputPosition(&writer->output));
+
+  finishWritingBinaryTrees(&writer->output, &addresses, additionalData, additionalDataSize, dictionaryAddress);
+}
+
+//Write the contents of the output buffer of a writer at checkpointAddress
+//(i.e., in place of the trailer of the last checkpoint), and clear the
+//buffer. The END marker at the end of the file is overwritten (and flushed)
+//first, so that a program reading the file in the meantime finds no valid
+//trailer, rather than one whose addresses point at the bytes being replaced.
+static void writeOverCheckpoint(BinaryTreeWriter* writer)
+{
+  writer->file.seekp(0, std::fstream::end);
+  int64_t fileSize = (int64_t)writer->file.tellp();
+
+  if (fileSize >= writer->checkpointAddress + 4)
+  {
+    byte invalidMarker[4] = { 0, 0, 0, 0 };
+
+    writer->file.seekp(fileSize - 4);
+    writer->file.write((const char*)invalidMarker, 4);
+    writer->file.flush();
+  }
+
+  writer->file.seekp(writer->checkpointAddress);
+  writer->file.write((const char*)writer->output.buffer.data(), writer->output.buffer.size());
+  writer->file.flush();
+
+  if (writer->file.fail())
+  {
+    Rcpp::stop("ERROR! Could not write to the file.");
+  }
+
+  writer->output.buffer.clear();
+}
+
+//Write the trees that have been buffered since the last checkpoint, followed
+//by a provisional trailer (and the global dictionary block, if necessary), in
+//place of the trailer of the last checkpoint. The trailer is written again
+//(with the new trees) at the next checkpoint.
+static void writeCheckpoint(BinaryTreeWriter* writer)
+{
+  int64_t trailerAddress = outputPosition(&writer->output);
+
+  writeWriterTrailer(writer, NULL, 0);
+
+  writeOverCheckpoint(writer);
+
+  writer->output.offset = trailerAddress;
+  writer->checkpointAddress = trailerAddress;
+
+  writer->lastCheckpointTrees = writer->addresses.size();
+  writer->lastCheckpointTime = std::chrono::steady_clock::now();
+}
+
+//Determine whether a checkpoint should be written, according to the number of
+//trees and the time since the last checkpoint.
+static bool isCheckpointDue(BinaryTreeWriter* writer)
+{
+  if (writer->checkpointTrees > 0 && writer->addresses.size() - writer->lastCheckpointTrees >= (size_t)writer->checkpointTrees)
+  {
+    return true;
+  }
+
+  if (writer->checkpointSeconds > 0)
+  {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - writer->lastCheckpointTime;
+    return elapsed.count() >= writer->checkpointSeconds;
+  }
+
+  return false;
+}
+
+//Write the header of the file of a writer. If checkpoints are enabled, an
+//empty trailer is also written immediately, so that the file can be read
+//from the start.
+static void beginWriter(BinaryTreeWriter* writer)
+{
+  beginWritingBinaryTrees(&writer->output, writer->globalDictionaries);
+
+  if (writer->output.file == NULL)
+  {
+    writer->checkpointAddress = 0;
+    writeCheckpoint(writer);
+  }
+  else
+  {
+    flushOutput(&writer->output);
+  }
+}
+
+//Write a tree to the output of a writer.
+static void writeWriterTree(BinaryTreeWriter* writer, phylo* tree)
+{
+  writer->addresses.push_back(outputPosition(&writer->output));
+
+  if (writer->globalDictionaries)
+  {
+    addToDictionaries(writer, tree);
+    writeBinaryTree(tree, &writer->output, true, true, &writer->names, &writer->attributes, &writer->attributesReverse);
+  }
+  else
+  {
+    writeBinaryTree(tree, &writer->output);
+  }
+
+  flushOutputIfFull(&writer->output);
+}
+
+//Called after a batch of trees has been written: if checkpoints are enabled,
+//write a checkpoint if one is due (otherwise, the trees stay in memory);
+//if not, pass the trees on to the operating system.
+static void endWriterBatch(BinaryTreeWriter* writer)
+{
+  if (writer->checkpointAddress >= 0)
+  {
+    if (isCheckpointDue(writer))
+    {
+      writeCheckpoint(writer);
+    }
+  }
+  else
+  {
+    flushOutput(&writer->output);
+    writer->file.flush();
+  }
+}
+
+//Write the global dictionary block (if necessary), the additional data and
+//the trailer of the file of a writer, and close it. If checkpoints are
+//enabled, these are written together with the buffered trees in place of the
+//trailer of the last checkpoint.
+static void closeWriter(BinaryTreeWriter* writer, const byte* additionalData, size_t additionalDataSize)
+{
+  writeWriterTrailer(writer, additionalData, additionalDataSize);
+
+  if (writer->checkpointAddress >= 0)
+  {
+    writeOverCheckpoint(writer);
+  }
+
+  writer->file.close();
+}
+
+//Create a file in binary tree format and write an empty header, returning an
+//external pointer to a writer that keeps the file open. If globalDictionaries
+//is true, the trees refer to global names and attributes, which are stored
+//when the writer is closed. If checkpointTrees or checkpointSeconds are
+//greater than 0, provisional trailers are written while the file is open.
+//[[Rcpp::export]]
+SEXP Rcpp_open_binary_tree_writer(std::string fileName, bool globalDictionaries, int checkpointTrees, double checkpointSeconds)
+{
+  Rcpp::XPtr<BinaryTreeWriter> writer(new BinaryTreeWriter(fileName, globalDictionaries, checkpointTrees, checkpointSeconds), true);
+
+  if (!writer->file.is_open())
+  {
+    Rcpp::stop("ERROR! Could not open the file for writing.");
+  }
+
+  beginWriter(writer.get());
+
+  return writer;
+}
+
+//Write trees provided by R to a file opened with Rcpp_open_binary_tree_writer.
+//Without checkpoints, the trees are passed on to the operating system at the
+//end of each call, so that a file that is not closed properly can be
+//repaired (unless it uses global dictionaries, which are only written with
+//the trailer). With checkpoints, the trees are kept in memory until the next
+//checkpoint is due, and a file that is not closed properly contains the trees
+//up to the last checkpoint. Returns the number of trees that have been
+//written so far.
+//[[Rcpp::export]]
+int Rcpp_binary_tree_writer_write(SEXP handle, Rcpp::List trees)
+{
+  BinaryTreeWriter* writer = getWriter(handle);
+
+  for (R_xlen_t i = 0; i < trees.size(); i++)
+  {
+    Rcpp::List tree = trees[i];
+    phylo convertedTree = convertTree(&tree);
+
+    writeWriterTree(writer, &convertedTree);
+  }
+
+  endWriterBatch(writer);
+
+  return (int)writer->addresses.size();
+}
+
+//Finalise a file opened with Rcpp_open_binary_tree_writer by writing the
+//global dictionary block (if necessary), the additional data and the trailer
+//(in place of the provisional trailer, if there is one), and close it.
+//[[Rcpp::export]]
+void Rcpp_close_binary_tree_writer(SEXP handle, std::vector<Rbyte> additionalData)
+{
+  BinaryTreeWriter* writer = getWriter(handle);
+
+  closeWriter(writer, additionalData.data(), additionalData.size());
+
+  Rcpp::XPtr<BinaryTreeWriter> writerPointer(handle);
+  writerPointer.release();
+}